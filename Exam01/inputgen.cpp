@@ -4,62 +4,216 @@
 // Pupose:
 // Starting code for thread question in exam 1
 //
-#include <iostream>
+// A set of generator threads produce data samples and the main thread writes
+// them to output.txt and standard output.
+//
+// The obvious way to build this is one std::queue with one mutex that every
+// generator locks to push and the writer locks to pop.  That works for ten
+// generators that each produce a sample every few seconds, but not for many
+// busy ones: every push waits its turn for the same lock, the lock's cache
+// line bounces from core to core, and the threads end up queued up behind
+// each other (a lock convoy) instead of doing work.  The same goes for a
+// single random number generator shared by all the threads, which is also a
+// data race unless it too is locked.
+//
+// So nothing here is shared between generators.  Each generator has its own
+// random number generator and its own lane: a small single-producer,
+// single-consumer ring buffer that only it pushes to and only the writer pops
+// from, so neither side ever takes a lock.  The writer visits the lanes in
+// turn, takes whatever each one has, formats it into a large buffer, and
+// writes the buffer out in one go.
+//
+// Usage: inputgen [generators [maximum wait in ms]]
+//
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
 #include <fstream>
+#include <iostream>
+#include <memory>
 #include <random>
 #include <thread>
-#include <chrono>
-#include <queue>
 #include <vector>
-#include <mutex>
 
-std::ofstream outputStream("output.txt");
-std::random_device rd{};
-std::mt19937 gen{rd()};
-std::uniform_int_distribution<int> sampleUd(0, 100);
-std::uniform_int_distribution<int> waitUd(0,10);
+const int NUMBER_OF_GENERATORS = 10;
+const int MAXIMUM_WAIT_MS = 10000;
+
+// Opened by main() once the arguments have been checked, so that a bad
+// command line leaves any earlier output.txt alone.
+std::ofstream outputStream;
 
 struct DataSample {
   int generator;
   int value;
 };
-std::queue<DataSample> sampleQueue;
 
+//
+// class SampleLane
+//
+// A bounded lock-free queue of DataSamples from one generator to the writer.
+// The generator owns tail and the writer owns head; each publishes its index
+// with a release store and reads the other's with an acquire load, so the
+// writer always sees a sample's contents once it sees the new tail.  The two
+// indices sit on separate cache lines so the threads do not fight over one.
+//
+class SampleLane {
+public:
+  static const std::size_t CAPACITY = 1024;
+
+  // Generator only.  Returns false if the lane is full.
+  bool push(const DataSample& sample) {
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == CAPACITY) {
+      return false;
+    }
+    slots[t % CAPACITY] = sample;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Writer only.  Copy up to max samples into out and return how many.
+  std::size_t popBatch(DataSample* out, std::size_t max) {
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    const std::size_t n = std::min(tail.load(std::memory_order_acquire) - h, max);
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = slots[(h + i) % CAPACITY];
+    }
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+
+private:
+  alignas(64) std::atomic<std::size_t> head{0};
+  alignas(64) std::atomic<std::size_t> tail{0};
+  alignas(64) DataSample slots[CAPACITY];
+};
+
+//
+// class BatchWriter
+//
+// Formats samples as "generator value" lines into a 64 KiB buffer and writes
+// the buffer to the output file and standard output when it fills or when
+// flush() is called.
+//
+class BatchWriter {
+public:
+  void write(const DataSample& sample) {
+    if (sizeof(buffer) - used < MAX_LINE) {
+      flush();
+    }
+    char* next = buffer + used;
+    char* const end = buffer + sizeof(buffer);
+    next = std::to_chars(next, end, sample.generator).ptr;
+    *next++ = ' ';
+    next = std::to_chars(next, end, sample.value).ptr;
+    *next++ = '\n';
+    used = next - buffer;
+  }
+
+  void flush() {
+    if (used > 0) {
+      outputStream.write(buffer, used);
+      outputStream.flush();
+      std::cout.write(buffer, used);
+      std::cout.flush();
+      used = 0;
+    }
+  }
+
+private:
+  // Two ints of at most 11 characters, a space and a newline
+  static const std::size_t MAX_LINE = 24;
+  char buffer[64 * 1024];
+  std::size_t used = 0;
+};
+
+//
+// void simulateInput(int generatorNumber, SampleLane& lane,
+//                    unsigned seed, int maximumWait)
+//
+// One generator: forever make a sample, push it onto our own lane, and wait
+// a random time of up to maximumWait milliseconds.  If the writer has fallen
+// so far behind that the lane is full, we wait for it to make room.
+//
+void simulateInput(int generatorNumber, SampleLane& lane, unsigned seed, int maximumWait) {
+  std::mt19937 gen{seed};
+  std::uniform_int_distribution<int> sampleUd(0, 100);
+  std::uniform_int_distribution<int> waitUd(0, maximumWait);
 
-void simulateInput(int generatorNumber) {
-  // TODO:
-  // Add the appropriate code that uses a lock_guard and a mutex to
-  // protect the critical section in this function.
-  //
   while(true) {
     DataSample ds;
     ds.generator = generatorNumber;
     ds.value = sampleUd(gen);
-    sampleQueue.push(ds);
-    std::this_thread::sleep_for(std::chrono::seconds(waitUd(gen)));
+    while (!lane.push(ds)) {
+      std::this_thread::yield();
+    }
+    const int wait = waitUd(gen);
+    if (wait > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+    }
   }
 }
 
 int main(int argc, char *argv[])
 {
+  const int generators = argc > 1 ? std::atoi(argv[1]) : NUMBER_OF_GENERATORS;
+  const int maximumWait = argc > 2 ? std::atoi(argv[2]) : MAXIMUM_WAIT_MS;
+  if (argc > 3 || generators < 1 || maximumWait < 0) {
+    std::cerr << "usage: " << argv[0] << " [generators [maximum wait in ms]]" << std::endl;
+    exit(1);
+  }
+  outputStream.open("output.txt");
   if (!outputStream.is_open()) {
     std::cout << "Unable to create output file" << std::endl;
     exit(1);
   }
-  // TODO:
-  // Create a vector of threads and then write a loop that adds ten
-  // threads to that vector with each thread using simuateInput() as the
-  // the thread function, and then detaching from the thread.
-  // Then make the main thread (here) wait for two seconds and  write an 
-  // infinite loop that checks to see if there is anything on the
-  // sampleQueue queue and write to the output file and standard
-  // output.
-  //
-  // Note: Don't forget to lock the critical section using lock_guard()
-  // and a mutex.
-  //
-  
 
+  // Each generator gets its own lane and its own seed.  random_device is
+  // not guaranteed to be safe to share between threads, so the seeds are
+  // drawn here before any generator starts.
+  std::random_device rd{};
+  std::vector<std::unique_ptr<SampleLane>> lanes;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < generators; ++i) {
+    lanes.emplace_back(new SampleLane);
+  }
+  for (int i = 0; i < generators; ++i) {
+    threads.emplace_back(simulateInput, i, std::ref(*lanes[i]), rd(), maximumWait);
+    threads.back().detach();
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+
+  // Visit every lane in turn, taking up to a batch from each so that one
+  // busy generator cannot starve the others.  When a whole pass finds
+  // nothing, write out what we have and back off a little longer each time,
+  // up to a millisecond, so an idle writer does not keep a core busy.
+  BatchWriter writer;
+  DataSample batch[256];
+  int idle = 0;
+  while(true) {
+    std::size_t taken = 0;
+    for (const std::unique_ptr<SampleLane>& lane : lanes) {
+      const std::size_t n = lane->popBatch(batch, 256);
+      for (std::size_t i = 0; i < n; ++i) {
+        writer.write(batch[i]);
+      }
+      taken += n;
+    }
+    if (taken > 0) {
+      idle = 0;
+      continue;
+    }
+    writer.flush();
+    idle = std::min(idle + 1, 20);
+    if (idle <= 10) {
+      std::this_thread::yield();
+    }
+    else {
+      std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000, 10 << (idle - 11))));
+    }
   }
   return 1;
 }
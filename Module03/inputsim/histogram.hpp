@@ -0,0 +1,177 @@
+/*
+ * File:     histogram.hpp
+ * Author:   Adam.Lewis@athens.edu
+ *
+ * A histogram of latencies for working out percentiles, in the style of
+ * HdrHistogram.
+ *
+ * Keeping every latency and sorting them is out of the question at a million
+ * samples a second, and a histogram with evenly sized buckets either has far
+ * too many buckets or cannot tell 3 microseconds from 4.  What we want is a
+ * fixed *relative* error, so the buckets are log-bucketed: every power of two
+ * gets the same number of sub-buckets, SUB_BUCKETS of them, evenly spaced
+ * within it.  Values below SUB_BUCKETS get a bucket each.  So a value is
+ * always reported to within 1 part in SUB_BUCKETS (under 1%), whether it is
+ * 200 nanoseconds or 2 seconds, and all of int64_t fits in 7424 buckets.
+ *
+ * NOTES:
+ * (a) Finding a value's bucket is a count-leading-zeros, a shift and an add;
+ * there are no loops, no floating point and no allocation, so recording is
+ * cheap enough to do for every sample.
+ * (b) Exactly one thread records into a histogram, but another may read it
+ * while it does.  The counts are atomics that the recorder updates with
+ * relaxed loads and stores (no read-modify-write, since it is the only
+ * writer), which on x86 costs the same as plain integers.  A reader takes a
+ * copy with copyFrom() and works with that; the copy may be a few samples
+ * out of date, which for percentiles does not matter.
+ * (c) Percentiles are reported, like HdrHistogram does, as the highest value
+ * that falls in the same bucket as the real one.
+ *
+ */
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+class LatencyHistogram
+{
+public:
+  static const int SUB_BUCKET_BITS = 7;
+  static const int64_t SUB_BUCKETS = int64_t(1) << SUB_BUCKET_BITS;
+  static const size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  LatencyHistogram() = default;
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  //
+  // void record(int64_t value)
+  //
+  // Recorder only.  Count one more value; anything negative counts as 0.
+  //
+  void record(int64_t value)
+  {
+    std::atomic<uint64_t> &bucket = counts[indexOf(value < 0 ? 0 : value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  //
+  // void copyFrom(const LatencyHistogram &other)
+  //
+  // Make this a copy of other, as it is right now.
+  //
+  void copyFrom(const LatencyHistogram &other)
+  {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+      const uint64_t n = other.counts[i].load(std::memory_order_relaxed);
+      counts[i].store(n, std::memory_order_relaxed);
+      sum += n;
+    }
+    total.store(sum, std::memory_order_relaxed);
+  }
+
+  //
+  // void subtract(const LatencyHistogram &earlier)
+  //
+  // Take away the counts of an earlier copy of the same histogram, leaving
+  // just what was recorded in between.
+  //
+  void subtract(const LatencyHistogram &earlier)
+  {
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+      counts[i].store(counts[i].load(std::memory_order_relaxed) -
+                      earlier.counts[i].load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+    }
+    total.store(total.load(std::memory_order_relaxed) -
+                earlier.total.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+  }
+
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+  //
+  // int64_t valueAt(double percentile) const
+  //
+  // The value that percentile percent of the recorded values are at or
+  // below; 0 if nothing has been recorded.
+  //
+  int64_t valueAt(double percentile) const
+  {
+    const uint64_t n = count();
+    if (n == 0)
+    {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * n + 0.5);
+    rank = rank < 1 ? 1 : (rank > n ? n : rank);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+      seen += counts[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+      {
+        return highestIn(i);
+      }
+    }
+    return highestIn(BUCKETS - 1);
+  }
+
+  //
+  // void print(std::ostream &out, double scale, const char *unit) const
+  //
+  // One line of the usual percentiles, with every value divided by scale
+  // (1000 to print nanoseconds as microseconds, say).
+  //
+  void print(std::ostream &out, double scale, const char *unit) const
+  {
+    static const double PERCENTILES[] = {50.0, 90.0, 99.0, 99.9, 99.99, 100.0};
+    static const char *const NAMES[] = {"p50", "p90", "p99", "p99.9", "p99.99", "max"};
+    out << "latency " << unit << ":";
+    for (size_t i = 0; i < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); ++i)
+    {
+      out << " " << NAMES[i] << " " << valueAt(PERCENTILES[i]) / scale;
+    }
+    out << " (" << count() << " samples)\n";
+  }
+
+private:
+  std::atomic<uint64_t> counts[BUCKETS] = {};
+  std::atomic<uint64_t> total{0};
+
+  // Values below SUB_BUCKETS are their own index.  Above that, a value whose
+  // top bit is bit e is shifted right by e - SUB_BUCKET_BITS to keep its top
+  // SUB_BUCKET_BITS + 1 bits, which land it in the upper half of a block of
+  // SUB_BUCKETS * 2; each further shift moves up by SUB_BUCKETS.
+  static size_t indexOf(int64_t value)
+  {
+    if (value < SUB_BUCKETS)
+    {
+      return static_cast<size_t>(value);
+    }
+    const int shift = 63 - __builtin_clzll(static_cast<uint64_t>(value)) - SUB_BUCKET_BITS;
+    return (static_cast<size_t>(shift) << SUB_BUCKET_BITS) + static_cast<size_t>(value >> shift);
+  }
+
+  // The largest value that indexOf() puts in bucket index.
+  static int64_t highestIn(size_t index)
+  {
+    if (index < static_cast<size_t>(2 * SUB_BUCKETS))
+    {
+      return static_cast<int64_t>(index);
+    }
+    const int shift = static_cast<int>(index >> SUB_BUCKET_BITS) - 1;
+    const uint64_t lowest = static_cast<uint64_t>(index - (static_cast<size_t>(shift) << SUB_BUCKET_BITS)) << shift;
+    return static_cast<int64_t>(lowest + (uint64_t(1) << shift) - 1);
+  }
+};
+
+#endif
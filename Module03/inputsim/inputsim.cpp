@@ -9,9 +9,11 @@
  * project.
  *
  * NOTES:
- * (a) Be aware that this code has some potential race conditions in how it's
- * reading from the deque.  You will address these conditions in the
- * aforementioned homework assignment.
+ * (a) The two threads hand samples over through the single-producer,
+ * single-consumer ring buffer in ringbuffer.hpp.  An unsynchronized deque
+ * shared between the threads is a data race, and polling empty() in a loop
+ * keeps a core busy even when nothing is arriving; the ring buffer is
+ * race-free without a lock, and a consumer with nothing to do sleeps.
  * (b) Most people are aware of the srand()/rand() pseudo-random number
  * generator that's in the cstdlib library.  It's preferred with Modern C++ to
  * use the C++ STL's random classes.
@@ -19,25 +21,93 @@
  * application. There are multiple ways of doing this but the preferred method
  * in Modern C++ is a combination of methods from the chrono and thread
  * libraries
+ * (d) Given any of the -- options the program is instead a load generator for
+ * capacity testing whatever consumes the samples.  It runs open loop at up to
+ * millions of samples a second with exponential (or uniform, or constant)
+ * times between them, and reports the rates in and out and the queue depth.
+ * (e) Every sample is stamped with the time it was made, and the consumer
+ * records how long it sat in the queue in the histogram in histogram.hpp.
+ * Percentiles of that latency are printed every so often and when the
+ * program is stopped (with Ctrl-C, or at the end of a load run): a backlog
+ * that keeps growing shows up as percentiles that keep climbing.
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <random>
-#include <thread>
 #include <string>
-#include <sstream>
-#include <deque>
+#include <thread>
 #include <chrono>
+#include "histogram.hpp"
+#include "ringbuffer.hpp"
+#include "sample.hpp"
 
 // I am being lazy here... the common preference is to not do a using
 // statement. 
 using namespace std;
 
-// We will be using this deque as a shared global between two threads: a thread
+// We will be using this queue as a shared global between two threads: a thread
 // that simulates the reading of a set of devices and the main thread that is
-// extracting values from the queue and printing them.
-deque<string> inputQueue;
+// extracting values from the queue and printing them.  It holds at most
+// QUEUE_CAPACITY samples; if the main thread falls that far behind, the
+// simulator waits for it to catch up.  What goes through it is the Sample
+// record from sample.hpp; it only becomes text when main() prints it.
+//
+// The queue is sized for load generator mode (see generateLoad()), where a
+// deep queue lets the consumer ride out a hiccup of a few milliseconds at a
+// million samples a second without losing anything.
+const size_t QUEUE_CAPACITY = 1 << 16;
+RingBuffer<Sample, QUEUE_CAPACITY> inputQueue;
+
+// How long each sample waited in the queue, in nanoseconds, from when it was
+// made to when the consumer took it.  Only the consumer records into it.
+LatencyHistogram queueLatency;
+
+// Set when we are asked to stop with SIGINT or SIGTERM.
+atomic<bool> stopping{false};
+
+//
+// void requestStop(int signal)
+//
+// Load generator mode's signal handler: tell the generator to stop.  The
+// generator closes the queue itself once it has, so every sample it made
+// is either consumed or counted as dropped and the totals add up.
+//
+extern "C" void requestStop(int)
+{
+  stopping.store(true);
+}
+
+//
+// void requestDemoStop(int signal)
+//
+// The demo's signal handler.  The consumer there is blocked in pop() for
+// most of its life, so close the queue to wake it up; it drains what is
+// left and finishes up.  The demo keeps no totals, so a sample the
+// simulator pushes after this is of no consequence.  close() is only
+// lock-free atomics and a system call, so it is safe in a signal handler.
+//
+extern "C" void requestDemoStop(int)
+{
+  stopping.store(true);
+  inputQueue.close();
+}
+
+//
+// void takeSample(const Sample &sample)
+//
+// Consumer only.  Record how long sample spent in the queue.
+//
+inline void takeSample(const Sample &sample)
+{
+  queueLatency.record(nowNanoseconds() - sample.timestamp);
+}
 
 //
 // void simulateInput(int rate)
@@ -52,16 +122,15 @@ deque<string> inputQueue;
 // selecting a uniformly distributed integer (this is what we
 // commonly think of when we do random numbers in a program) between 0 and 10.
 //
-// We build the data for the queue using a string stream.  The randomly
-// generated data is written to the stream and we then push the backing string
-// onto the queue.
+// Each event becomes a Sample, stamped with the time it was made, and is
+// pushed onto the queue as it is.
 //
 
 void simulateInput(int rate) 
 {
   random_device rd{};
   mt19937 gen{rd()};
-  int count = 0;
+  uint64_t count = 0;
 
   poisson_distribution<> pD(rate);
   normal_distribution<> nD(5.0, 3.0);
@@ -74,54 +143,372 @@ void simulateInput(int rate)
     {
       for (int i = 0; i < numberEvents; ++i)
       {
-        stringstream sampleStream;
-        int deviceNumber = uD(gen);
-        float sample = nD(gen);
-        count++;
-        sampleStream << count << " " << deviceNumber << " " << sample;
-        inputQueue.push_front(sampleStream.str());
+        Sample sample;
+        sample.device = uD(gen);
+        sample.value = nD(gen);
+        sample.seq = ++count;
+        sample.timestamp = nowNanoseconds();
+        inputQueue.push(sample);
       }
     }
     this_thread::sleep_for(chrono::milliseconds(1000));
   }
 }
 
+// How load generator mode is set up from the command line.  The arrival
+// distribution describes the time between one sample and the next:
+// exponential gives Poisson arrivals (bursty, like independent devices),
+// uniform spreads the gaps evenly between 0 and twice the mean, and
+// constant makes them all the same.
+enum class Arrivals { EXPONENTIAL, UNIFORM, CONSTANT };
+
+struct LoadOptions
+{
+  double rate = 100000.0;       // samples per second, on average
+  int devices = 11;
+  double duration = 10.0;       // seconds
+  double interval = 1.0;        // seconds between reports
+  Arrivals arrivals = Arrivals::EXPONENTIAL;
+  string output;                // where the consumer writes samples, if anywhere
+};
+
+// Running totals for load generator mode.  Each counter has exactly one
+// thread writing it, and sits on its own cache line so that the reporter
+// reading them does not slow the writers down.
+struct LoadCounters
+{
+  alignas(64) atomic<uint64_t> generated{0};
+  alignas(64) atomic<uint64_t> dropped{0};
+  alignas(64) atomic<uint64_t> consumed{0};
+  alignas(64) atomic<bool> finished{false};
+};
+
+LoadCounters counters;
+
+//
+// void generateLoad(const LoadOptions &options)
+//
+// Load generator mode's producer.  This is an open-loop generator: when each
+// sample arrives is decided up front by the arrival distribution, not by how
+// fast the consumer takes them, which is what a real set of devices does and
+// what a capacity test needs.  So if the queue is full the sample is counted
+// as dropped rather than waited for, and if we fall behind schedule the
+// overdue samples are produced straight away.
+//
+// The arrival times are kept in nanoseconds.  Sleeping is only accurate to
+// around 50 microseconds, so for the last stretch before an arrival we spin;
+// at high rates the gaps are shorter than that and we never sleep at all.
+//
+void generateLoad(const LoadOptions &options)
+{
+  random_device rd{};
+  mt19937 gen{rd()};
+  normal_distribution<> nD(5.0, 3.0);
+  uniform_int_distribution<int> uD(0, options.devices - 1);
+  const double meanGap = 1e9 / options.rate;
+  exponential_distribution<> exponentialGap(1.0 / meanGap);
+  uniform_real_distribution<> uniformGap(0.0, 2.0 * meanGap);
+  auto gap = [&]() -> double
+  {
+    switch (options.arrivals)
+    {
+      case Arrivals::EXPONENTIAL: return exponentialGap(gen);
+      case Arrivals::UNIFORM: return uniformGap(gen);
+      default: return meanGap;
+    }
+  };
+
+  const int64_t SPIN_NS = 100000;
+  const int64_t start = nowNanoseconds();
+  const int64_t end = start + static_cast<int64_t>(options.duration * 1e9);
+  double next = start + gap();
+  uint64_t generated = 0;
+  uint64_t dropped = 0;
+  while (true)
+  {
+    int64_t now = nowNanoseconds();
+    if (next >= end || now >= end || stopping.load(memory_order_relaxed))
+    {
+      break;
+    }
+    if (now < next)
+    {
+      if (next - now > SPIN_NS)
+      {
+        this_thread::sleep_for(chrono::nanoseconds(static_cast<int64_t>(next - now) - SPIN_NS / 2));
+      }
+      continue;
+    }
+    Sample sample;
+    sample.device = uD(gen);
+    sample.value = nD(gen);
+    sample.seq = ++generated;
+    sample.timestamp = now;
+    if (!inputQueue.tryPush(sample))
+    {
+      ++dropped;
+      counters.dropped.store(dropped, memory_order_relaxed);
+    }
+    counters.generated.store(generated, memory_order_relaxed);
+    next += gap();
+  }
+  inputQueue.close();
+}
+
+//
+// void consumeLoad(const LoadOptions &options)
+//
+// Load generator mode's consumer: take samples as fast as they come, record
+// their latency, and write them to the output file if there is one.
+//
+void consumeLoad(const LoadOptions &options)
+{
+  ofstream file;
+  if (!options.output.empty())
+  {
+    file.open(options.output);
+  }
+  SampleWriter writer(file);
+  uint64_t consumed = 0;
+  Sample sample;
+  while (inputQueue.pop(sample))
+  {
+    do
+    {
+      takeSample(sample);
+      if (file.is_open())
+      {
+        writer.write(sample);
+      }
+      ++consumed;
+    } while (inputQueue.tryPop(sample));
+    counters.consumed.store(consumed, memory_order_relaxed);
+  }
+  counters.consumed.store(consumed, memory_order_relaxed);
+}
+
+//
+// void reportLoad(const LoadOptions &options)
+//
+// Every interval print how many samples were generated and consumed per
+// second since the last report, how many have been dropped so far, and how
+// deep the queue is now and at most since the last report.  The depth is
+// looked at every millisecond to catch the peaks.  Under that goes the
+// latency of the samples consumed since the last report.  At the end print
+// the totals and the latency over the whole run.
+//
+void reportLoad(const LoadOptions &options)
+{
+  const int64_t start = nowNanoseconds();
+  int64_t lastReport = start;
+  uint64_t lastGenerated = 0;
+  uint64_t lastConsumed = 0;
+  size_t maxDepth = 0;
+  LatencyHistogram latency;
+  LatencyHistogram previous;
+  LatencyHistogram interval;
+
+  cout << fixed << setprecision(1);
+  cout << "time_s\tgenerated/s\tconsumed/s\tdropped\tdepth\tmax_depth" << endl;
+  while (!counters.finished.load())
+  {
+    this_thread::sleep_for(chrono::milliseconds(1));
+    maxDepth = max(maxDepth, inputQueue.size());
+    const int64_t now = nowNanoseconds();
+    if (now - lastReport < options.interval * 1e9)
+    {
+      continue;
+    }
+    const uint64_t generated = counters.generated.load();
+    const uint64_t consumed = counters.consumed.load();
+    const double seconds = (now - lastReport) / 1e9;
+    cout << (now - start) / 1e9 << "\t" << (generated - lastGenerated) / seconds << "\t"
+         << (consumed - lastConsumed) / seconds << "\t" << counters.dropped.load() << "\t"
+         << inputQueue.size() << "\t" << maxDepth << "\n";
+    latency.copyFrom(queueLatency);
+    interval.copyFrom(latency);
+    interval.subtract(previous);
+    interval.print(cout, 1000.0, "us");
+    cout.flush();
+    previous.copyFrom(latency);
+    lastReport = now;
+    lastGenerated = generated;
+    lastConsumed = consumed;
+    maxDepth = 0;
+  }
+
+  const double seconds = (nowNanoseconds() - start) / 1e9;
+  const uint64_t generated = counters.generated.load();
+  const uint64_t consumed = counters.consumed.load();
+  cout << "Generated " << generated << " (" << generated / seconds << "/s), consumed "
+       << consumed << " (" << consumed / seconds << "/s), dropped "
+       << counters.dropped.load() << " in " << seconds << " s\n";
+  latency.copyFrom(queueLatency);
+  latency.print(cout, 1000.0, "us");
+  cout.flush();
+}
+
+//
+// int runLoad(const LoadOptions &options)
+//
+// Load generator mode: the generator, the consumer and the reporter each on
+// their own thread, for the given duration or until we are stopped.
+//
+int runLoad(const LoadOptions &options)
+{
+  thread reporter(reportLoad, cref(options));
+  thread consumer(consumeLoad, cref(options));
+  generateLoad(options);
+  consumer.join();
+  counters.finished.store(true);
+  reporter.join();
+  return 0;
+}
+
+void usage(const char *program)
+{
+  cerr << "usage: " << program << " [rate]\n"
+       << "       " << program << " [options]   (load generator mode)\n"
+       << "  --rate R            samples per second\n"
+       << "  --devices N         number of devices\n"
+       << "  --duration S        seconds to run\n"
+       << "  --distribution D    exponential, uniform or constant arrivals\n"
+       << "  --interval S        seconds between reports\n"
+       << "  --output FILE       write the samples to FILE" << endl;
+}
+
 //
 // int main(int argc, char *argv[])
 //
 // We test our input simulator by creating two threads: our main application
 // thread (created when we start our program) and a thread that executes the
 // simulateInput() program.   Then, we go into an infinite loop reading and
-// printing the data values from the input queue.
+// printing the data values from the input queue.  The average sample rate
+// can be given on the command line.  Every LATENCY_REPORT_SECONDS, and when
+// we are stopped, the queue latency percentiles go to standard error, out of
+// the way of the samples.
 //
-// NOTES:
-// You must manually terminate this program as both threads intentionally
-// has infinite loops.
+// Any of the options switches to load generator mode instead, which runs
+// for a fixed time at a much higher rate and reports on how the consumer
+// keeps up rather than printing the samples.
 //
-// TODO:
-// For the moment, we use a constant to define the average sample rate passed
-// to the simulateInput() function.  This needs to be changed to get that value
-// from the command-line arguments.
+// Printing goes through a SampleWriter.  We take everything that is waiting
+// in the queue, format it into the writer's buffer, and only write the
+// buffer out when the queue runs dry (or the buffer fills up), so a burst of
+// samples costs one write rather than one per sample.
+//
+// NOTES:
+// Without the options you must manually terminate this program as both
+// threads intentionally has infinite loops.
 //
 
 const int SAMPLE_ARRIVAL_RATE = 3;
+const int LATENCY_REPORT_SECONDS = 10;
 int main(int argc, char *argv[])
 {
-  inputQueue.push_front("0 START");
+  int rate = SAMPLE_ARRIVAL_RATE;
+  LoadOptions options;
+  bool load = false;
+  bool valid = true;
+  for (int i = 1; i < argc; ++i)
+  {
+    const string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0)
+    {
+      valid = valid && i == 1;
+      rate = atoi(arg.c_str());
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      valid = false;
+      break;
+    }
+    const string value = argv[++i];
+    load = true;
+    if (arg == "--rate")
+    {
+      options.rate = atof(value.c_str());
+    }
+    else if (arg == "--devices")
+    {
+      options.devices = atoi(value.c_str());
+    }
+    else if (arg == "--duration")
+    {
+      options.duration = atof(value.c_str());
+    }
+    else if (arg == "--interval")
+    {
+      options.interval = atof(value.c_str());
+    }
+    else if (arg == "--output")
+    {
+      options.output = value;
+    }
+    else if (arg == "--distribution" && value == "exponential")
+    {
+      options.arrivals = Arrivals::EXPONENTIAL;
+    }
+    else if (arg == "--distribution" && value == "uniform")
+    {
+      options.arrivals = Arrivals::UNIFORM;
+    }
+    else if (arg == "--distribution" && value == "constant")
+    {
+      options.arrivals = Arrivals::CONSTANT;
+    }
+    else
+    {
+      valid = false;
+    }
+  }
+  valid = valid && rate > 0 && options.rate > 0.0 && options.devices > 0 &&
+          options.duration > 0.0 && options.interval > 0.0 && !(load && argc > 1 && argv[1][0] != '-');
+  if (!valid)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  if (load)
+  {
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    return runLoad(options);
+  }
+  signal(SIGINT, requestDemoStop);
+  signal(SIGTERM, requestDemoStop);
+
   // Build and lanuch the input simulator thread
-  thread inputThread(simulateInput, SAMPLE_ARRIVAL_RATE);
+  thread inputThread(simulateInput, rate);
   inputThread.detach();
   // Pause three seconds
   cout << "Pausing three seconds for station identification" << endl;
   this_thread::sleep_for(chrono::milliseconds(3000));
-  // Now start printing stuff from the queue
-  while(true)
+  // Now start printing stuff from the queue, sleeping while it is empty
+  cout << "0 START" << endl;
+  SampleWriter writer(cout);
+  Sample sample;
+  LatencyHistogram previous;
+  LatencyHistogram interval;
+  int64_t lastReport = nowNanoseconds();
+  while(inputQueue.pop(sample))
   {
-    if (! inputQueue.empty())
+    do
+    {
+      takeSample(sample);
+      writer.write(sample);
+    } while (inputQueue.tryPop(sample));
+    writer.flush();
+    if (nowNanoseconds() - lastReport >= LATENCY_REPORT_SECONDS * 1000000000LL)
     {
-      string sample = inputQueue.back();
-      inputQueue.pop_back();
-      cout << sample << endl;
+      interval.copyFrom(queueLatency);
+      interval.subtract(previous);
+      interval.print(cerr, 1000.0, "us");
+      previous.copyFrom(queueLatency);
+      lastReport = nowNanoseconds();
     }
   }
+  queueLatency.print(cerr, 1000.0, "us");
+  return 0;
 }
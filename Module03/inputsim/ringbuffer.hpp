@@ -0,0 +1,275 @@
+/*
+ * File:     ringbuffer.hpp
+ * Author:   Adam.Lewis@athens.edu
+ *
+ * A bounded, lock-free queue for exactly one producer thread and one consumer
+ * thread.
+ *
+ * The queue is a fixed array of slots used as a ring.  The producer owns the
+ * tail index and the consumer owns the head index; each only ever writes its
+ * own, so no locks are needed.  The indices just count up forever and are
+ * reduced modulo the capacity (a power of two, so that is a mask) to find the
+ * slot.  The queue is empty when head == tail and full when tail - head ==
+ * capacity.
+ *
+ * NOTES:
+ * (a) Memory ordering.  The producer fills in a slot and then publishes it by
+ * storing the new tail with release order.  The consumer reads the tail with
+ * acquire order, which guarantees it also sees everything written to the slot
+ * before the tail was stored.  The head works the same way in the other
+ * direction, so the producer never overwrites a slot the consumer is still
+ * reading.
+ * (b) False sharing.  Each index lives on its own 64 byte cache line, next to
+ * the copy of the *other* index that its owner keeps.  The owner only
+ * re-reads the other thread's index when its copy says the queue is
+ * full (or empty), so most operations touch no shared cache line at all.
+ * (c) Blocking.  pop() and push() spin for a little while, since the other
+ * side is usually only moments away, and then go to sleep in the kernel on a
+ * futex rather than burning a core.  A thread that changes the queue only
+ * makes the (comparatively expensive) wake-up system call if the other side
+ * has said it is asleep.  On systems without futexes the sleeping side
+ * naps for a short while instead.
+ * (d) close() tells the consumer no more items are coming: once the queue has
+ * drained, pop() returns false instead of waiting.
+ *
+ */
+
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//
+// void futexWait(std::atomic<uint32_t> &word, uint32_t expected)
+// void futexWake(std::atomic<uint32_t> &word)
+//
+// Sleep until woken, as long as word still holds expected when we get to the
+// kernel (if it does not, return at once); wake everyone sleeping on word.
+// Spurious wake-ups are possible, so callers always re-check.
+//
+inline void futexWait(std::atomic<uint32_t> &word, uint32_t expected)
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+#else
+  if (word.load() == expected)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+#endif
+}
+
+inline void futexWake(std::atomic<uint32_t> &word)
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE,
+          INT32_MAX, nullptr, nullptr, 0);
+#else
+  (void) word;
+#endif
+}
+
+template <typename T, std::size_t Capacity>
+class RingBuffer
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  RingBuffer() = default;
+  RingBuffer(const RingBuffer &) = delete;
+  RingBuffer &operator=(const RingBuffer &) = delete;
+
+  static constexpr std::size_t capacity() { return Capacity; }
+
+  //
+  // bool tryPush(T item)
+  //
+  // Producer only.  Add item and return true, or return false if the queue
+  // is full.
+  //
+  bool tryPush(T item)
+  {
+    return tryPushFrom(item);
+  }
+
+  //
+  // void push(T item)
+  //
+  // Producer only.  Add item, waiting for room if the queue is full.
+  //
+  void push(T item)
+  {
+    while (!tryPushFrom(item))
+    {
+      waitFor(producer, [this] { return !full(); });
+    }
+  }
+
+  //
+  // bool tryPop(T &item)
+  //
+  // Consumer only.  Take the oldest item and return true, or return false if
+  // the queue is empty.
+  //
+  bool tryPop(T &item)
+  {
+    const std::size_t head = consumer.index.load(std::memory_order_relaxed);
+    if (head == consumer.otherIndex)
+    {
+      consumer.otherIndex = producer.index.load(std::memory_order_acquire);
+      if (head == consumer.otherIndex)
+      {
+        return false;
+      }
+    }
+    item = std::move(slots[head & (Capacity - 1)]);
+    consumer.index.store(head + 1, std::memory_order_release);
+    wake(producer);
+    return true;
+  }
+
+  //
+  // bool pop(T &item)
+  //
+  // Consumer only.  Take the oldest item, waiting for one if the queue is
+  // empty.  Returns false only if the queue is empty and has been closed.
+  //
+  bool pop(T &item)
+  {
+    while (!tryPop(item))
+    {
+      if (closed.load(std::memory_order_acquire))
+      {
+        // One more look: items pushed before close() must not be lost
+        return tryPop(item);
+      }
+      waitFor(consumer, [this] { return !empty() || closed.load(); });
+    }
+    return true;
+  }
+
+  //
+  // void close()
+  //
+  // Producer only.  No more items will be pushed.
+  //
+  void close()
+  {
+    closed.store(true, std::memory_order_release);
+    consumer.signal.fetch_add(1);
+    futexWake(consumer.signal);
+  }
+
+  // Number of items in the queue.  Only a snapshot when called by anyone
+  // other than the producer or consumer.
+  std::size_t size() const
+  {
+    return producer.index.load(std::memory_order_acquire) -
+           consumer.index.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() >= Capacity; }
+
+private:
+  static const int SPIN_LIMIT = 1000;
+
+  // Everything one side owns, on its own cache line.  index is the side's
+  // own index (the tail for the producer, the head for the consumer),
+  // otherIndex its last look at the other side's index.  signal is bumped
+  // to wake the side when it is asleep, which it says with sleeping.
+  struct alignas(64) Side
+  {
+    std::atomic<std::size_t> index{0};
+    std::size_t otherIndex = 0;
+    std::atomic<uint32_t> signal{0};
+    std::atomic<bool> sleeping{false};
+  };
+
+  Side producer;
+  Side consumer;
+  std::atomic<bool> closed{false};
+  T slots[Capacity];
+
+  //
+  // bool tryPushFrom(T &item)
+  //
+  // tryPush(), but item is only moved from if there is room for it, so that
+  // push() can try again with the same item.
+  //
+  bool tryPushFrom(T &item)
+  {
+    const std::size_t tail = producer.index.load(std::memory_order_relaxed);
+    if (tail - producer.otherIndex == Capacity)
+    {
+      producer.otherIndex = consumer.index.load(std::memory_order_acquire);
+      if (tail - producer.otherIndex == Capacity)
+      {
+        return false;
+      }
+    }
+    slots[tail & (Capacity - 1)] = std::move(item);
+    producer.index.store(tail + 1, std::memory_order_release);
+    wake(consumer);
+    return true;
+  }
+
+  //
+  // void wake(Side &side)
+  //
+  // We just changed the queue; if side is asleep waiting for that, wake it.
+  // The fence pairs with the one in waitFor(): either we see that side is
+  // asleep, or side sees our change before it goes to sleep.
+  //
+  void wake(Side &side)
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (side.sleeping.load(std::memory_order_relaxed))
+    {
+      side.signal.fetch_add(1, std::memory_order_release);
+      futexWake(side.signal);
+    }
+  }
+
+  //
+  // void waitFor(Side &side, Ready ready)
+  //
+  // Wait, as side, until ready() says the queue has changed: spin a little,
+  // then sleep on side's futex.
+  //
+  template <typename Ready>
+  void waitFor(Side &side, Ready ready)
+  {
+    for (int spin = 0; spin < SPIN_LIMIT; ++spin)
+    {
+      if (ready())
+      {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    const uint32_t signal = side.signal.load(std::memory_order_acquire);
+    side.sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!ready())
+    {
+      futexWait(side.signal, signal);
+    }
+    side.sleeping.store(false, std::memory_order_relaxed);
+  }
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * File:     sample.hpp
+ * Author:   Adam.Lewis@athens.edu
+ *
+ * The record the input simulator passes from the devices to the consumer,
+ * and the code that turns records into text.
+ *
+ * NOTES:
+ * (a) A Sample is plain old data: a fixed size, no pointers, nothing to
+ * allocate or free.  Handing one over through the queue is a copy of 24
+ * bytes.  Building a string for every sample instead means a stringstream,
+ * a trip through the iostream formatting machinery and a heap allocation for
+ * every single event, and at high rates that is where the time goes.
+ * (b) We only turn samples into text at the very end, and then many at a
+ * time.  SampleWriter formats into one big buffer with std::to_chars, which
+ * does no allocation, no locale lookups and no virtual calls, and hands the
+ * buffer to the stream in one write when it fills up (or when asked to).
+ *
+ */
+
+#ifndef SAMPLE_HPP
+#define SAMPLE_HPP
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <type_traits>
+
+struct Sample
+{
+  uint64_t seq;         // sequence number, counting from 1
+  uint32_t device;      // which device it came from
+  float value;          // what the device read
+  int64_t timestamp;    // when it was made, steady_clock nanoseconds
+};
+
+static_assert(std::is_trivially_copyable<Sample>::value, "Sample must stay plain data");
+
+//
+// int64_t nowNanoseconds()
+//
+// The steady_clock time used for Sample::timestamp.
+//
+inline int64_t nowNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class SampleWriter
+{
+public:
+  explicit SampleWriter(std::ostream &out) : out(out) {}
+  SampleWriter(const SampleWriter &) = delete;
+  SampleWriter &operator=(const SampleWriter &) = delete;
+  ~SampleWriter() { flush(); }
+
+  //
+  // void write(const Sample &sample)
+  //
+  // Append sample to the buffer as "seq device value timestamp", one per
+  // line, with the value to 6 significant digits like cout would print it.
+  //
+  void write(const Sample &sample)
+  {
+    if (BUFFER_SIZE - used < MAX_LINE)
+    {
+      flush();
+    }
+    char *next = buffer + used;
+    char *const end = buffer + BUFFER_SIZE;
+    next = std::to_chars(next, end, sample.seq).ptr;
+    *next++ = ' ';
+    next = std::to_chars(next, end, sample.device).ptr;
+    *next++ = ' ';
+    next = std::to_chars(next, end, sample.value, std::chars_format::general, 6).ptr;
+    *next++ = ' ';
+    next = std::to_chars(next, end, sample.timestamp).ptr;
+    *next++ = '\n';
+    used = next - buffer;
+  }
+
+  //
+  // void flush()
+  //
+  // Hand everything buffered so far to the stream.
+  //
+  void flush()
+  {
+    if (used > 0)
+    {
+      out.write(buffer, used);
+      out.flush();
+      used = 0;
+    }
+  }
+
+private:
+  static const size_t BUFFER_SIZE = 64 * 1024;
+  // Longest possible line: 20 digits of seq, 10 of device, 14 characters
+  // of value, 20 of timestamp, the spaces and the newline
+  static const size_t MAX_LINE = 80;
+
+  std::ostream &out;
+  char buffer[BUFFER_SIZE];
+  size_t used = 0;
+};
+
+#endif
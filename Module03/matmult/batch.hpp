@@ -0,0 +1,260 @@
+//
+// File:   batch.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Multiply thousands of small matrices at once.
+//
+// For a 4x4 or 16x16 multiply the kernels in the rest of the program are
+// hopeless.  The packing, the blocking and the dispatch all cost more than
+// the 128 or 8192 flops of the multiply itself, and the matrices are too
+// small to fill the SIMD registers along a row.  With a whole batch of them,
+// though, we can turn the problem on its side and vectorize across the
+// batch instead: lane l of every SIMD register works on matrix l.
+//
+// For that the batch is stored interleaved.  The matrices are taken LANES
+// at a time (LANES is however many elements fill a 64 byte cache line, so
+// 16 floats), and within such a chunk element (i, j) of all LANES matrices
+// sit next to each other:
+//
+//   chunk c, element (i, j), matrix l  ->  data[c][(i * cols + j) * LANES + l]
+//
+// Then the multiply of a chunk is the textbook triple loop with one more,
+// over the lanes, innermost, where every load and store is a full aligned
+// vector and there is not a shuffle in sight.
+//
+// The sizes are template parameters, so for each size the compiler sees
+// loops with constant trip counts, unrolls them and keeps the partial sums
+// in registers.  multiply_batch<M, K, N>() picks the size at compile time;
+// the overload without template arguments picks a specialized kernel for
+// every square size from 2 to MAX_SQUARE at run time and a general one for
+// the rest.  Like the SIMD kernel, each size is compiled for AVX-512, AVX2
+// and plain SSE2 and the best the CPU supports is used.
+//
+// The chunks are shared out over a ThreadPool.
+//
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "matrix.hpp"
+#include "threadpool.hpp"
+
+template <typename T>
+class BatchMatrix {
+public:
+  static const long LANES = BasicMatrix<T>::ALIGNMENT / sizeof(T);
+
+  BatchMatrix(long count, long rows, long cols)
+    : nCount(count), nRows(rows), nCols(cols),
+      storage((count + LANES - 1) / LANES, rows * cols * LANES) {
+  }
+
+  long count() const { return nCount; }
+  long rows() const { return nRows; }
+  long cols() const { return nCols; }
+  long chunks() const { return storage.rows(); }
+
+  T* chunk(long c) { return storage.row(c); }
+  const T* chunk(long c) const { return storage.row(c); }
+
+  // Element (i, j) of matrix b.
+  T& operator()(long b, long i, long j) {
+    return storage(b / LANES, (i * nCols + j) * LANES + b % LANES);
+  }
+  T operator()(long b, long i, long j) const {
+    return storage(b / LANES, (i * nCols + j) * LANES + b % LANES);
+  }
+
+  // The padding lanes of the last chunk are filled in too, so that they
+  // hold numbers rather than garbage, but nobody looks at them.
+  void initalizeZero() { storage.initalizeZero(); }
+  void initalizeRandom() { storage.initalizeRandom(); }
+
+private:
+  long nCount;
+  long nRows;
+  long nCols;
+  BasicMatrix<T> storage;
+};
+
+// void multiplyChunks<M, K, N>(long m, long k, long n, long chunks, T *c,
+//                              const T *a, const T *b)
+//
+// c = a * b for chunks consecutive chunks of M x K times K x N matrices.
+// When M, K and N are 0 the sizes are taken from m, k and n instead.
+// Always inlined, so that it is compiled for the instruction set of the
+// function it ends up in.
+//
+template <int M, int K, int N, typename T>
+__attribute__((always_inline)) inline
+void multiplyChunks(long m, long k, long n, long chunks, T* c, const T* a, const T* b) {
+  const long L = BatchMatrix<T>::LANES;
+  const long rows = M ? M : m;
+  const long inner = K ? K : k;
+  const long cols = N ? N : n;
+  for (long chunk = 0; chunk < chunks; ++chunk) {
+    for (long i = 0; i < rows; ++i) {
+      for (long j = 0; j < cols; ++j) {
+        T sum[L] = {};
+        for (long p = 0; p < inner; ++p) {
+          const T* ai = a + (i * inner + p) * L;
+          const T* bj = b + (p * cols + j) * L;
+          for (long l = 0; l < L; ++l) {
+            sum[l] += ai[l] * bj[l];
+          }
+        }
+        T* cij = c + (i * cols + j) * L;
+        for (long l = 0; l < L; ++l) {
+          cij[l] = sum[l];
+        }
+      }
+    }
+    a += rows * inner * L;
+    b += inner * cols * L;
+    c += rows * cols * L;
+  }
+}
+
+template <typename T>
+using BatchKernel = void (*)(long m, long k, long n, long chunks, T* c, const T* a, const T* b);
+
+template <int M, int K, int N, typename T>
+void batchKernelGeneric(long m, long k, long n, long chunks, T* c, const T* a, const T* b) {
+  multiplyChunks<M, K, N>(m, k, n, chunks, c, a, b);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <int M, int K, int N, typename T>
+__attribute__((target("avx2,fma")))
+void batchKernelAVX2(long m, long k, long n, long chunks, T* c, const T* a, const T* b) {
+  multiplyChunks<M, K, N>(m, k, n, chunks, c, a, b);
+}
+
+template <int M, int K, int N, typename T>
+__attribute__((target("avx512f")))
+void batchKernelAVX512(long m, long k, long n, long chunks, T* c, const T* a, const T* b) {
+  multiplyChunks<M, K, N>(m, k, n, chunks, c, a, b);
+}
+#endif
+
+// BatchKernel<T> batchKernel<M, K, N, T>()
+//
+// The M x K times K x N kernel for the widest instruction set this CPU has,
+// chosen once per size.
+//
+template <int M, int K, int N, typename T>
+BatchKernel<T> batchKernel() {
+  static const BatchKernel<T> chosen = []() -> BatchKernel<T> {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return batchKernelAVX512<M, K, N, T>;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return batchKernelAVX2<M, K, N, T>;
+    }
+#endif
+    return batchKernelGeneric<M, K, N, T>;
+  }();
+  return chosen;
+}
+
+// void checkBatch(const BatchMatrix<T> &c, const BatchMatrix<T> &a,
+//                 const BatchMatrix<T> &b)
+//
+// Throw std::invalid_argument unless c = a * b makes sense: the same
+// number of matrices in all three, a's columns matching b's rows, and c
+// shaped like the product.
+//
+template <typename T>
+void checkBatch(const BatchMatrix<T>& c, const BatchMatrix<T>& a, const BatchMatrix<T>& b) {
+  if (a.count() != b.count() || a.count() != c.count() ||
+      a.cols() != b.rows() || c.rows() != a.rows() || c.cols() != b.cols()) {
+    throw std::invalid_argument("multiply_batch: batch sizes or dimensions do not match");
+  }
+}
+
+// void runBatch(BatchKernel<T> kernel, BatchMatrix<T> &c,
+//               const BatchMatrix<T> &a, const BatchMatrix<T> &b,
+//               ThreadPool &pool)
+//
+// Share the chunks out over the pool, a few runs of chunks per thread, and
+// run kernel on each run.
+//
+template <typename T>
+void runBatch(BatchKernel<T> kernel, BatchMatrix<T>& c,
+              const BatchMatrix<T>& a, const BatchMatrix<T>& b, ThreadPool& pool) {
+  const long chunks = c.chunks();
+  const long tasks = std::min<long>(chunks, 4L * pool.size());
+  pool.parallelFor(tasks, [&](long task) {
+    const long begin = chunks * task / tasks;
+    const long end = chunks * (task + 1) / tasks;
+    kernel(a.rows(), a.cols(), b.cols(), end - begin,
+           c.chunk(begin), a.chunk(begin), b.chunk(begin));
+  });
+}
+
+// void multiply_batch<M, K, N>(BatchMatrix<T> &c, const BatchMatrix<T> &a,
+//                              const BatchMatrix<T> &b,
+//                              ThreadPool &pool = sharedPool())
+//
+// c[i] = a[i] * b[i] for every matrix in the batch, where every a[i] is
+// M x K and every b[i] is K x N.  All three batches must hold the same
+// number of matrices, and c must already be a batch of M x N; if not,
+// std::invalid_argument is thrown.
+//
+template <int M, int K, int N, typename T>
+void multiply_batch(BatchMatrix<T>& c, const BatchMatrix<T>& a, const BatchMatrix<T>& b,
+                    ThreadPool& pool = sharedPool()) {
+  checkBatch(c, a, b);
+  if (a.rows() != M || a.cols() != K || b.cols() != N) {
+    throw std::invalid_argument("multiply_batch: matrices are not the size of the kernel");
+  }
+  runBatch(batchKernel<M, K, N, T>(), c, a, b, pool);
+}
+
+const int MAX_SQUARE = 32;
+
+// BatchKernel<T> squareKernel<T>(long size)
+//
+// The kernel specialized for size x size matrices, or nullptr if there
+// is none.  squareKernelFrom() builds the table, one for each size from
+// 2 to MAX_SQUARE.
+//
+template <typename T, int... Sizes>
+BatchKernel<T> squareKernelFrom(long size, std::integer_sequence<int, Sizes...>) {
+  static const BatchKernel<T> kernels[] = {
+    batchKernel<Sizes + 2, Sizes + 2, Sizes + 2, T>()...
+  };
+  return size >= 2 && size <= MAX_SQUARE ? kernels[size - 2] : nullptr;
+}
+
+template <typename T>
+BatchKernel<T> squareKernel(long size) {
+  return squareKernelFrom<T>(size, std::make_integer_sequence<int, MAX_SQUARE - 1>());
+}
+
+// void multiply_batch(BatchMatrix<T> &c, const BatchMatrix<T> &a,
+//                     const BatchMatrix<T> &b, ThreadPool &pool = sharedPool())
+//
+// The same with the sizes taken from the batches.  Square matrices from
+// 2 x 2 to MAX_SQUARE x MAX_SQUARE get their own kernels; anything else
+// uses one that reads the sizes at run time.
+//
+template <typename T>
+void multiply_batch(BatchMatrix<T>& c, const BatchMatrix<T>& a, const BatchMatrix<T>& b,
+                    ThreadPool& pool = sharedPool()) {
+  checkBatch(c, a, b);
+  BatchKernel<T> kernel = nullptr;
+  if (a.rows() == a.cols() && a.cols() == b.cols()) {
+    kernel = squareKernel<T>(a.rows());
+  }
+  if (kernel == nullptr) {
+    kernel = batchKernel<0, 0, 0, T>();
+  }
+  runBatch(kernel, c, a, b, pool);
+}
+
+#endif
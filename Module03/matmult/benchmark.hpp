@@ -0,0 +1,174 @@
+//
+// File:   benchmark.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// A small benchmark harness: time a piece of work over and over and boil
+// the times down to numbers we can trust.
+//
+// Three things make a naive timing loop lie to you:
+//
+//  - Coarse clocks.  system_clock in milliseconds reads 0 for anything
+//    quick, and it can jump when the wall clock is adjusted.  We time each
+//    run on its own with steady_clock, which only ever goes forward, and
+//    keep the result in nanoseconds.
+//
+//  - Cold starts.  The first run pays for page faults, cold caches, lazy
+//    initialization and the CPU ramping up its clock.  We do a few untimed
+//    warmup runs first.
+//
+//  - Averages.  One run that got preempted drags the average a long way.
+//    We keep every time and report the minimum (the best the code can do),
+//    the median (what it typically does), the 95th percentile (how bad it
+//    gets) and the standard deviation (how noisy the measurement is).
+//
+// Results can be written out as CSV or JSON for plotting or for comparing
+// before and after a change.
+//
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Summary of a set of timed runs.  All times are in nanoseconds.
+struct TimingStats {
+  long runs = 0;
+  double minNs = 0.0;
+  double medianNs = 0.0;
+  double p95Ns = 0.0;
+  double meanNs = 0.0;
+  double stddevNs = 0.0;
+};
+
+// TimingStats summarize(std::vector<double> ns)
+//
+// Percentiles use the nearest-rank method; the standard deviation is the
+// sample standard deviation.
+//
+inline TimingStats summarize(std::vector<double> ns) {
+  TimingStats stats;
+  stats.runs = ns.size();
+  if (ns.empty()) {
+    return stats;
+  }
+  std::sort(ns.begin(), ns.end());
+  auto rank = [&](double q) {
+    const long index = static_cast<long>(std::ceil(q * ns.size())) - 1;
+    return ns[std::max(0L, std::min(index, stats.runs - 1))];
+  };
+  stats.minNs = ns.front();
+  stats.medianNs = rank(0.5);
+  stats.p95Ns = rank(0.95);
+  double sum = 0.0;
+  for (double t : ns) {
+    sum += t;
+  }
+  stats.meanNs = sum / ns.size();
+  if (ns.size() > 1) {
+    double squares = 0.0;
+    for (double t : ns) {
+      squares += (t - stats.meanNs) * (t - stats.meanNs);
+    }
+    stats.stddevNs = std::sqrt(squares / (ns.size() - 1));
+  }
+  return stats;
+}
+
+// TimingStats timeRuns(long warmup, long runs, Work work)
+//
+// Call work() warmup times without looking at the clock, then runs more
+// times timing each call.
+//
+template <typename Work>
+TimingStats timeRuns(long warmup, long runs, Work work) {
+  for (long i = 0; i < warmup; ++i) {
+    work();
+  }
+  std::vector<double> ns;
+  ns.reserve(runs);
+  for (long i = 0; i < runs; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    work();
+    const auto end = std::chrono::steady_clock::now();
+    ns.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+  }
+  return summarize(std::move(ns));
+}
+
+// One row of a benchmark sweep.  flops is the work done by one run, so the
+// rate in GFLOP/s is simply flops per nanosecond.  bytes is the least memory
+// traffic a run can get away with (reading each input and writing the result
+// once), so bytes per nanosecond is the bandwidth the operands are consumed
+// at, which is what changes with the element type.  density is the fraction
+// of the input elements that were nonzero, and batch the number of size x
+// size multiplies one run does.
+struct BenchmarkResult {
+  std::string kernel;
+  std::string type;
+  long size = 0;
+  double density = 1.0;
+  long batch = 1;
+  unsigned threads = 1;
+  double flops = 0.0;
+  double bytes = 0.0;
+  TimingStats timing;
+
+  double gflops() const { return timing.medianNs > 0.0 ? flops / timing.medianNs : 0.0; }
+  double bestGflops() const { return timing.minNs > 0.0 ? flops / timing.minNs : 0.0; }
+  double gbytesPerSecond() const { return timing.medianNs > 0.0 ? bytes / timing.medianNs : 0.0; }
+};
+
+// void writeCsv(std::ostream &out, const std::vector<BenchmarkResult> &results)
+//
+// One header line, then one line per result.
+//
+inline void writeCsv(std::ostream& out, const std::vector<BenchmarkResult>& results) {
+  const std::streamsize precision = out.precision(10);
+  out << "kernel,type,size,density,batch,threads,runs,min_ns,median_ns,p95_ns,mean_ns,stddev_ns,"
+      << "gflops_median,gflops_best,bytes,gbytes_per_s_median\n";
+  for (const BenchmarkResult& r : results) {
+    out << r.kernel << ',' << r.type << ',' << r.size << ',' << r.density << ','
+        << r.batch << ',' << r.threads << ','
+        << r.timing.runs << ',' << r.timing.minNs << ',' << r.timing.medianNs << ','
+        << r.timing.p95Ns << ',' << r.timing.meanNs << ',' << r.timing.stddevNs << ','
+        << r.gflops() << ',' << r.bestGflops() << ',' << r.bytes << ','
+        << r.gbytesPerSecond() << '\n';
+  }
+  out.precision(precision);
+}
+
+// void writeJson(std::ostream &out, const std::string &machine,
+//                const std::vector<BenchmarkResult> &results)
+//
+// An object with the caller's machine description (itself a JSON object)
+// and an array of results.  Kernel names are written as is, so they should
+// not need escaping.
+//
+inline void writeJson(std::ostream& out, const std::string& machine,
+                      const std::vector<BenchmarkResult>& results) {
+  const std::streamsize precision = out.precision(10);
+  out << "{\n  \"machine\": " << machine << ",\n  \"results\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& r = results[i];
+    out << (i == 0 ? "\n" : ",\n")
+        << "    {\"kernel\": \"" << r.kernel << "\", \"type\": \"" << r.type
+        << "\", \"size\": " << r.size << ", \"density\": " << r.density
+        << ", \"batch\": " << r.batch
+        << ", \"threads\": " << r.threads << ", \"runs\": " << r.timing.runs
+        << ", \"min_ns\": " << r.timing.minNs << ", \"median_ns\": " << r.timing.medianNs
+        << ", \"p95_ns\": " << r.timing.p95Ns << ", \"mean_ns\": " << r.timing.meanNs
+        << ", \"stddev_ns\": " << r.timing.stddevNs
+        << ", \"gflops_median\": " << r.gflops() << ", \"gflops_best\": " << r.bestGflops()
+        << ", \"bytes\": " << r.bytes << ", \"gbytes_per_s_median\": " << r.gbytesPerSecond()
+        << "}";
+  }
+  out << "\n  ]\n}\n";
+  out.precision(precision);
+}
+
+#endif
@@ -0,0 +1,50 @@
+//
+// File:   bfloat16.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// The bfloat16 number format.
+//
+// A bfloat16 is the top half of a 32-bit float: the same sign bit and 8-bit
+// exponent, but only 7 bits of mantissa.  So it covers the same range as a
+// float with about 2-3 decimal digits of precision, in half the memory.
+// Converting to float is just a shift; converting from float rounds the
+// dropped 16 bits to nearest, ties to even.
+//
+// Most CPUs cannot do arithmetic on bfloat16 directly, so we emulate it: the
+// numbers are stored as bfloat16, widened to float when they are loaded, and
+// multiplied and accumulated in float.  That still halves the memory traffic
+// of the inputs, which is usually what the format is for.
+//
+#ifndef BFLOAT16_HPP
+#define BFLOAT16_HPP
+
+#include <cstdint>
+#include <cstring>
+
+struct bfloat16 {
+  std::uint16_t bits = 0;
+
+  bfloat16() = default;
+
+  explicit bfloat16(float value) {
+    std::uint32_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    if ((word & 0x7fffffffu) > 0x7f800000u) {
+      // NaN: keep it a (quiet) NaN rather than letting rounding carry it
+      // into infinity.
+      bits = static_cast<std::uint16_t>((word >> 16) | 0x0040u);
+      return;
+    }
+    word += 0x7fffu + ((word >> 16) & 1u);
+    bits = static_cast<std::uint16_t>(word >> 16);
+  }
+
+  operator float() const {
+    const std::uint32_t word = static_cast<std::uint32_t>(bits) << 16;
+    float value;
+    std::memcpy(&value, &word, sizeof(value));
+    return value;
+  }
+};
+
+#endif
@@ -0,0 +1,128 @@
+//
+// File:   gemm.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Cache-blocked matrix multiply kernels.
+//
+// The textbook i-j-k loop walks down a column of m2 for every element of
+// the result.  Consecutive elements of a column are a whole row apart in
+// memory, so once the matrix is bigger than the cache every one of those
+// reads is a cache miss and the multiply spends its time waiting on memory.
+//
+// The blocked kernel fixes that in two ways.  First it switches to i-k-j
+// order: the innermost loop runs along a row of m2 and a row of the result,
+// both contiguous, so it streams through memory (and the compiler can
+// vectorize it).  Second it works on tiles: MC rows of m1 by KC columns is
+// sized to stay in L2 while it is reused against every column of the tile,
+// and a KC by NC panel of m2 is reused for every one of those rows.
+//
+// The best tile sizes depend on the machine, so there are several compiled
+// versions and autotuneBlocked() times them on a probe multiply at startup
+// and keeps the fastest one for multiplyTiled() to use.
+//
+#ifndef GEMM_HPP
+#define GEMM_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "matrix.hpp"
+
+using BlockedKernel = void (*)(Matrix& r, const Matrix& m1, const Matrix& m2);
+
+// void multiplyBlocked<MC, KC, NC>(Matrix &r, const Matrix &m1, const Matrix& m2)
+//
+// r = m1 * m2 for any compatible shapes: m1 is m x k, m2 is k x n, and r
+// must already be m x n.
+//
+template <long MC, long KC, long NC>
+void multiplyBlocked(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  const long m = m1.rows();
+  const long k = m1.cols();
+  const long n = m2.cols();
+  r.initalizeZero();
+  for (long jj = 0; jj < n; jj += NC) {
+    const long jEnd = std::min(jj + NC, n);
+    for (long kk = 0; kk < k; kk += KC) {
+      const long kEnd = std::min(kk + KC, k);
+      for (long ii = 0; ii < m; ii += MC) {
+        const long iEnd = std::min(ii + MC, m);
+        for (long i = ii; i < iEnd; ++i) {
+          float* __restrict rRow = r.row(i);
+          const float* aRow = m1.row(i);
+          for (long p = kk; p < kEnd; ++p) {
+            const float a = aRow[p];
+            const float* __restrict bRow = m2.row(p);
+            for (long j = jj; j < jEnd; ++j) {
+              rRow[j] += a * bRow[j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// The tile shapes we try.  MC x KC floats is what has to sit in L2;
+// KC x NC is the panel of m2 reused by each block of rows.
+struct BlockedCandidate {
+  const char* name;
+  BlockedKernel kernel;
+};
+
+static const BlockedCandidate BLOCKED_CANDIDATES[] = {
+  {"32x128x256", multiplyBlocked<32, 128, 256>},
+  {"64x128x512", multiplyBlocked<64, 128, 512>},
+  {"64x256x256", multiplyBlocked<64, 256, 256>},
+  {"128x256x512", multiplyBlocked<128, 256, 512>},
+  {"96x384x1024", multiplyBlocked<96, 384, 1024>},
+  {"256x128x2048", multiplyBlocked<256, 128, 2048>},
+};
+
+// The kernel multiplyTiled() uses until autotuneBlocked() picks another.
+inline BlockedKernel& tunedBlockedKernel() {
+  static BlockedKernel kernel = multiplyBlocked<64, 256, 256>;
+  return kernel;
+}
+
+// void autotuneBlocked(long probeSize, std::ostream &log = std::cout)
+//
+// Time every candidate on a probeSize x probeSize multiply, keeping the
+// best of three runs for each, and make the fastest the one
+// multiplyTiled() uses.  The choice is reported on log.
+//
+inline void autotuneBlocked(long probeSize, std::ostream& log = std::cout) {
+  Matrix a(probeSize, probeSize), b(probeSize, probeSize), c(probeSize, probeSize);
+  a.initalizeRandom();
+  b.initalizeRandom();
+
+  const BlockedCandidate* best = nullptr;
+  double bestTime = 0.0;
+  for (const BlockedCandidate& candidate : BLOCKED_CANDIDATES) {
+    double fastest = 0.0;
+    for (int run = 0; run < 3; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      candidate.kernel(c, a, b);
+      std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+      if (run == 0 || took.count() < fastest) {
+        fastest = took.count();
+      }
+    }
+    if (best == nullptr || fastest < bestTime) {
+      best = &candidate;
+      bestTime = fastest;
+    }
+  }
+  tunedBlockedKernel() = best->kernel;
+  log << "Autotuned tile size (MCxKCxNC): " << best->name << std::endl;
+}
+
+// void multiplyTiled(Matrix &r, const Matrix &m1, const Matrix& m2)
+//
+// Multiply with the blocked kernel chosen by the autotuner.
+//
+inline void multiplyTiled(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  tunedBlockedKernel()(r, m1, m2);
+}
+
+#endif
@@ -5,156 +5,617 @@
 // Use matrix multiply as a more complex example of using threads in C++
 //
 
+#include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <random>
 #include <chrono>
-#include <thread>
+#include <cmath>
 #include <functional>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "batch.hpp"
+#include "benchmark.hpp"
+#include "gemm.hpp"
+#include "matrix.hpp"
+#include "numa.hpp"
+#include "simdgemm.hpp"
+#include "sparse.hpp"
+#include "strassen.hpp"
+#include "threadpool.hpp"
 
-// Configure some useful namespaces for dealing with time stuff
-using std::chrono::duration_cast;
-using std::chrono::milliseconds;
-using std::chrono::seconds;
-using std::chrono::system_clock;
-
-// A few useful constants
+// A few useful constants.  The matrix size, number of timed runs and so on
+// are only defaults; all of them can be given on the command line.
 static const long MATRIX_SIZE = 100;
-static const int THREADS_NUMBER = 4;
 static const long NEXECUTIONS = 1e3;
+static const long NWARMUPS = 1;
+static const long BATCH_COUNT = 10000;
+static long matrixSize = MATRIX_SIZE;
+static long nExecutions = NEXECUTIONS;
+static long nWarmups = NWARMUPS;
+static double inputDensity = 1.0;
+static long batchCount = BATCH_COUNT;
+
+// Where the threads run and where the pages of the matrices go; see
+// numa.hpp.  By default the scheduler places the threads and the main
+// thread fills in, and so first touches, every matrix.  With first touch
+// each participant in the pool fills in its own band of rows, the same band
+// multiplyThreading() gives it to work on.  Interleave spreads the pages
+// over all the NUMA nodes instead, falling back to first touch on a machine
+// with only one node.
+enum class Placement { MAIN, FIRST_TOUCH, INTERLEAVE };
+static Placement placement = Placement::MAIN;
+static bool pinThreads = false;
+
+// Matrices are stored in the Matrix class from matrix.hpp: one aligned,
+// contiguous, row-major buffer per matrix.
+//
+// The multi-threaded versions run on a persistent pool from threadpool.hpp
+// rather than starting their own threads on every call.  Normally that is
+// the shared pool, one thread per core; the thread count sweep points
+// activePool at pools of other sizes.  So do the parallel parts of the
+// Strassen multiply.
+static ThreadPool* activePool = &sharedPool();
+static Strassen strassen(sharedPool());
+
+// A multiply of two matrices of In, with the result in whatever In
+// accumulates in (see AccumulatorOf in matrix.hpp).
+template <typename In>
+using MultiplyOf = void (*)(BasicMatrix<AccumulatorOf<In>>& r,
+                            const BasicMatrix<In>& m1, const BasicMatrix<In>& m2);
 
-// We need something to store our matrices.  The first reaction is to use an
-// 2-d array declared as a global or something allocated on a stack.  There are
-// some funky implementation issues with threads we have to address.  Remember
-// that each thread gets it's stack while all threads share the heap.  If we
-// are dealing with large arrays (which is quite realistic in most
-// applications), it is better to use the heap instead
-//
-// We add a few help methods for getting a matrix configured.
-
-struct Matrix {
-  float **elements;
-  // void initializeZero()
-  //
-  // Initialize the matrix and fill with zero.
-  // Note how this operates by allocating each row in the heap and then set all
-  // values to 0.0f.
-  //
-  void initalizeZero() {
-    elements = new float*[MATRIX_SIZE];
-    for (int i = 0; i < MATRIX_SIZE; ++i) {
-      elements[i] = new float[MATRIX_SIZE];
-      for (int j = 0; j < MATRIX_SIZE; ++j) {
-        elements[i][j] = 0.0f;
+// The multiply kernels we know how to benchmark.  The parallel ones are run
+// once for every thread count in the sweep, the others only on one thread.
+// Each one is benchmarked by its own instance of benchmarkExecution(), which
+// knows the element type, and peak is the nominal peak for that type.
+// Batched variants multiply a batch of small size x size matrices rather
+// than one big one, and only run when asked for by name.
+struct Variant {
+  const char* name;
+  const char* description;
+  const char* type;
+  BenchmarkResult (*benchmark)(const Variant& variant, long size, unsigned threads);
+  double (*peak)();
+  bool parallel;
+  bool batched = false;
+};
+
+//
+// Let's define some forward declarations so we can go top down in
+// in the code.
+//
+template <typename T>
+void multiply(BasicMatrix<AccumulatorOf<T>>& r, const BasicMatrix<T>& m1, const BasicMatrix<T>& m2);
+void multiplyThreaded(Matrix& r, const Matrix& m1, const Matrix& m2);
+void multiplyStrassen(Matrix& r, const Matrix& m1, const Matrix& m2);
+void multiplySparse(Matrix& r, const Matrix& m1, const Matrix& m2);
+void multiplySparseSparse(Matrix& r, const Matrix& m1, const Matrix& m2);
+void multiplyAuto(Matrix& r, const Matrix& m1, const Matrix& m2);
+template <typename In>
+void multiplyThreading(BasicMatrix<AccumulatorOf<In>>& result,
+                       ThreadPool& pool,
+                       const BasicMatrix<In>& m1,
+                       const BasicMatrix<In>& m2);
+long ownerOfRow(long row, long rows, unsigned participants);
+long firstRowOf(long owner, long rows, unsigned participants);
+template <typename T, typename Fill>
+void placeMatrix(BasicMatrix<T>& m, ThreadPool& pool, Fill fill);
+void scalingReport(std::ostream& out, long size);
+void strassenReport(std::ostream& out, long size);
+template <typename In, MultiplyOf<In> Multiply>
+BenchmarkResult benchmarkExecution(const Variant& variant, long size, unsigned threads);
+template <bool Interleaved>
+BenchmarkResult benchmarkBatch(const Variant& variant, long size, unsigned threads);
+ThreadPool& usePool(unsigned participants, std::unique_ptr<ThreadPool>& own);
+void useSharedPool();
+void printResult(std::ostream& out, const Variant& variant, const BenchmarkResult& result);
+std::vector<long> parseList(const std::string& list);
+void usage(const char* program);
+
+// The float kernels come first.  The rest run the naive and SIMD multiply
+// on other element types, to compare the speed and memory traffic of the
+// same multiply at lower and higher precision.
+static const Variant VARIANTS[] = {
+  {"naive", "Single execution", "f32",
+   benchmarkExecution<float, multiply<float>>, peakGflops<float>, false},
+  {"threads", "Multi thread execution", "f32",
+   benchmarkExecution<float, multiplyThreaded>, peakGflops<float>, true},
+  {"tiled", "Tiled execution", "f32",
+   benchmarkExecution<float, multiplyTiled>, peakGflops<float>, false},
+  {"simd", "SIMD execution", "f32",
+   benchmarkExecution<float, multiplySimd<float>>, peakGflops<float>, false},
+  {"strassen", "Strassen execution", "f32",
+   benchmarkExecution<float, multiplyStrassen>, peakGflops<float>, true},
+  {"spmm", "Sparse x dense execution", "f32",
+   benchmarkExecution<float, multiplySparse>, peakGflops<float>, true},
+  {"spgemm", "Sparse x sparse execution", "f32",
+   benchmarkExecution<float, multiplySparseSparse>, peakGflops<float>, true},
+  {"auto", "Dense or sparse by density", "f32",
+   benchmarkExecution<float, multiplyAuto>, peakGflops<float>, true},
+  {"naive-f64", "Single execution, double", "f64",
+   benchmarkExecution<double, multiply<double>>, peakGflops<double>, false},
+  {"simd-f64", "SIMD execution, double", "f64",
+   benchmarkExecution<double, multiplySimd<double>>, peakGflops<double>, false},
+  {"simd-bf16", "SIMD execution, bfloat16 into float", "bf16",
+   benchmarkExecution<bfloat16, multiplySimd<bfloat16>>, peakGflops<bfloat16>, false},
+  {"naive-i8", "Single execution, int8 into int32", "i8",
+   benchmarkExecution<std::int8_t, multiply<std::int8_t>>, peakGflops<std::int8_t>, false},
+  {"simd-i8", "SIMD execution, int8 into int32", "i8",
+   benchmarkExecution<std::int8_t, multiplySimd<std::int8_t>>, peakGflops<std::int8_t>, false},
+  {"batch", "Batched execution", "f32",
+   benchmarkBatch<true>, peakGflops<float>, true, true},
+  {"batch-loop", "Batch one matrix at a time", "f32",
+   benchmarkBatch<false>, peakGflops<float>, false, true},
+};
+
+// int main(int argc, char **argv)
+//
+// Usage: matmult [options] [size [executions]]
+//
+// With no options this runs every kernel once at the given size and prints
+// a readable report, followed by the thread scaling and Strassen reports.
+// The options turn it into a sweep that writes CSV or JSON:
+//
+//   --sizes LIST     matrix sizes to run, e.g. 128,256,512
+//   --threads LIST   thread counts for the parallel kernels
+//   --kernels LIST   any of naive,threads,tiled,simd,strassen, of
+//                    spmm,spgemm,auto, or of
+//                    naive-f64,simd-f64,simd-bf16,naive-i8,simd-i8
+//   --density D      fraction of the input elements that are nonzero
+//   --batch N        matrices per batch for the batch and batch-loop
+//                    kernels, which multiply N small size x size matrices
+//                    and are only run when named in --kernels
+//   --affinity A     none, or compact to pin each thread to its own CPU
+//   --placement P    main, first-touch or interleave
+//   --runs N         timed runs per measurement (same as executions)
+//   --warmup N       untimed runs before the timed ones
+//   --format F       text, csv or json
+//   --output FILE    write the results to FILE instead of the screen
+//
+int main(int argc, char**argv)
+{
+  std::vector<long> sizes;
+  std::vector<long> threadCounts;
+  std::vector<std::string> kernels;
+  std::string format = "text";
+  std::string outputPath;
+  std::vector<std::string> positional;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      positional.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--sizes") {
+      sizes = parseList(value);
+    }
+    else if (arg == "--threads") {
+      threadCounts = parseList(value);
+    }
+    else if (arg == "--kernels") {
+      std::stringstream names(value);
+      std::string name;
+      while (std::getline(names, name, ',')) {
+        kernels.push_back(name);
+      }
+    }
+    else if (arg == "--runs") {
+      nExecutions = std::atol(value.c_str());
+    }
+    else if (arg == "--warmup") {
+      nWarmups = std::atol(value.c_str());
+    }
+    else if (arg == "--batch") {
+      batchCount = std::atol(value.c_str());
+    }
+    else if (arg == "--density") {
+      inputDensity = std::atof(value.c_str());
+    }
+    else if (arg == "--affinity") {
+      if (value != "none" && value != "compact") {
+        usage(argv[0]);
+        return 1;
+      }
+      pinThreads = value == "compact";
+    }
+    else if (arg == "--placement") {
+      if (value == "main") {
+        placement = Placement::MAIN;
+      }
+      else if (value == "first-touch") {
+        placement = Placement::FIRST_TOUCH;
+      }
+      else if (value == "interleave") {
+        placement = Placement::INTERLEAVE;
       }
+      else {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (arg == "--format") {
+      format = value;
+    }
+    else if (arg == "--output") {
+      outputPath = value;
+    }
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (positional.size() > 0) {
+    matrixSize = std::atol(positional[0].c_str());
+  }
+  if (positional.size() > 1) {
+    nExecutions = std::atol(positional[1].c_str());
+  }
+  if (sizes.empty()) {
+    sizes.push_back(matrixSize);
+  }
+  if (threadCounts.empty()) {
+    threadCounts.push_back(sharedPool().size());
+  }
+
+  std::vector<const Variant*> selected;
+  for (const Variant& variant : VARIANTS) {
+    if ((kernels.empty() && !variant.batched) ||
+        std::find(kernels.begin(), kernels.end(), variant.name) != kernels.end()) {
+      selected.push_back(&variant);
     }
   }
 
-  // void initializeRandom()
-  //
-  // Initialize the matrix and fill with random values.   Observe the use of
-  // the C++ STL classes for generating random numbers.  This is preferred way
-  // to do this with modern C++.
-  //
-  void initalizeRandom() {
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_real_distribution<double> dist(-1e9, 1e9);
-    auto random = std::bind(dist, mt);
-    elements = new float*[MATRIX_SIZE];
-    for (int i = 0; i < MATRIX_SIZE; ++i) {
-      elements[i] = new float[MATRIX_SIZE];
-      for (int j = 0; j < MATRIX_SIZE; ++j) {
-        elements[i][j] = random();
-      }
+  bool valid = positional.size() <= 2 && nExecutions > 0 && nWarmups >= 0 &&
+               inputDensity > 0.0 && inputDensity <= 1.0 && batchCount > 0 &&
+               selected.size() > 0 &&
+               (format == "text" || format == "csv" || format == "json");
+  for (long size : sizes) {
+    valid = valid && size > 0;
+  }
+  for (long threads : threadCounts) {
+    valid = valid && threads > 0;
+  }
+  if (!valid) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::ofstream file;
+  if (!outputPath.empty()) {
+    file.open(outputPath);
+    if (!file) {
+      std::cerr << "Unable to write to " << outputPath << std::endl;
+      return 1;
     }
   }
+  std::ostream& out = outputPath.empty() ? std::cout : static_cast<std::ostream&>(file);
+  // In the text report the commentary is part of the output; otherwise it
+  // goes to stderr to keep the data clean.
+  const bool text = format == "text";
+  std::ostream& info = text ? out : std::cerr;
 
-  // void print()
-  //
-  // And we do have print things.
-  //
-  void print() {
-    std::cout << std::endl;
-    for (int i = 0; i < MATRIX_SIZE; ++i) {
-      std::cout << "|\t";
+  info << nExecutions << " timed executions after " << nWarmups << " warmup" << std::endl;
+  if (pinThreads && !pinThread(0)) {
+    info << "Unable to pin threads to CPUs, leaving them to the scheduler" << std::endl;
+    pinThreads = false;
+  }
+  if (placement == Placement::INTERLEAVE && numaNodes() < 2) {
+    info << "Only one NUMA node, so interleave falls back to first touch" << std::endl;
+  }
+  long largest = 0;
+  for (long size : sizes) {
+    largest = std::max(largest, size);
+  }
+  autotuneBlocked(std::min(largest, 256L), info);
+  calibrateSparse(std::min(largest, 256L), info);
+  info << "SIMD kernel: " << simdKernel().name;
+  if (peakGflops() > 0.0) {
+    info << ", nominal single core peak " << peakGflops() << " GFLOP/s";
+  }
+  info << std::endl;
+  info << "SIMD kernels by type: f64 " << simdKernelFor<double>().name
+       << ", bf16 " << simdKernelFor<bfloat16>().name
+       << ", i8 " << simdKernelFor<std::int8_t>().name << std::endl;
 
-      for (int j = 0; j < MATRIX_SIZE; ++j) {
-        std::cout << elements[i][j] << "\t";
+  std::vector<BenchmarkResult> results;
+  for (long size : sizes) {
+    for (const Variant* variant : selected) {
+      for (long threads : threadCounts) {
+        results.push_back(variant->benchmark(*variant, size, threads));
+        if (text) {
+          printResult(out, *variant, results.back());
+        }
+        if (!variant->parallel) {
+          break;
+        }
       }
-      std::cout << "|" << std::endl;
     }
   }
-};
 
+  if (format == "csv") {
+    writeCsv(out, results);
+  }
+  else if (format == "json") {
+    std::ostringstream machine;
+    machine << "{\"simd\": \"" << simdKernel().name << "\", \"simd_f64\": \""
+            << simdKernelFor<double>().name << "\", \"simd_i8\": \""
+            << simdKernelFor<std::int8_t>().name << "\", \"cores\": "
+            << ThreadPool::defaultThreads() << ", \"numa_nodes\": " << numaNodes()
+            << ", \"peak_gflops_per_core\": "
+            << peakGflops() << ", \"peak_gflops_per_core_f64\": " << peakGflops<double>()
+            << ", \"peak_gops_per_core_i8\": " << peakGflops<std::int8_t>() << "}";
+    writeJson(out, machine.str(), results);
+  }
+  else {
+    if (kernels.empty() && threadCounts.size() == 1) {
+      for (long size : sizes) {
+        scalingReport(out, size);
+        strassenReport(out, size);
+      }
+    }
+    out << "End of program" << std::endl;
+  }
+  return 0;
+}
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [options] [size [executions]]\n"
+            << "  --sizes LIST     matrix sizes, e.g. 128,256,512\n"
+            << "  --threads LIST   thread counts for the parallel kernels\n"
+            << "  --kernels LIST   naive,threads,tiled,simd,strassen,\n"
+            << "                   spmm,spgemm,auto,\n"
+            << "                   naive-f64,simd-f64,simd-bf16,naive-i8,simd-i8,\n"
+            << "                   batch,batch-loop\n"
+            << "  --batch N        matrices per batch for batch kernels\n"
+            << "  --density D      fraction of input elements that are nonzero\n"
+            << "  --affinity A     none or compact (pin threads to CPUs)\n"
+            << "  --placement P    main, first-touch or interleave\n"
+            << "  --runs N         timed runs per measurement\n"
+            << "  --warmup N       untimed runs before timing\n"
+            << "  --format F       text, csv or json\n"
+            << "  --output FILE    write results to FILE" << std::endl;
+}
+
+// std::vector<long> parseList(const std::string &list)
 //
-// Let's define some forward declarations so we can go top down in
-// in the code.
+// "128,256,512" -> {128, 256, 512}.  Anything that is not a number comes
+// back as 0, which main() rejects.
 //
-void multiply(Matrix& r, const Matrix& m1, const Matrix& m2);
-void singleExecution(Matrix& r,
-                     long long& elapsed_time,
-                     const Matrix& m1,
-                     const Matrix& m2);
-void multithreadingExecution(Matrix& r,
-                              long long& elapsed_time,
-                              const Matrix& m1,
-                              const Matrix& m2);
-void multiplyThreading(Matrix& result,
-                       const int thread_number,
-                       const Matrix& m1,
-                       const Matrix& m2);
-void benchmarkExecution(
-  void(*executionFunction)(Matrix& r,
-                            long long& elapsed_time,
-                            const Matrix& m1,
-                            const Matrix& m2));
-long long millisecondsNow();
+std::vector<long> parseList(const std::string& list) {
+  std::vector<long> values;
+  std::stringstream items(list);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    values.push_back(std::atol(item.c_str()));
+  }
+  return values;
+}
 
-// int main(int argc, char **argv)
 //
-int main(int argc, char**argv)
-{
-  std::cout << "Single execution" << std::endl;
-  benchmarkExecution(singleExecution);
-  std::cout << "Multi thread execution" << std::endl;
-  benchmarkExecution(multithreadingExecution);
-  std::cout << "End of program" << std::endl;
-  return 0;
+// BenchmarkResult benchmarkExecution<In, Multiply>(const Variant &variant,
+//                                                  long size, unsigned threads)
+//
+// This is the driver function that runs our little test.  It creates and
+// fills the two test arrays of In and calls Multiply for that algorithm over
+// and over with the harness from benchmark.hpp timing each run.
+//
+// The inputs are filled once, before any timing starts.  Refilling them on
+// every run would mean every run starts by pulling freshly written matrices
+// through the cache, and it is the multiply we want to time, not the random
+// number generator.  Every kernel overwrites the result, so it does not need
+// clearing between runs either.
+//
+// The pool is set up before the matrices are filled in, since with first
+// touch placement it is the pool's threads that fill them.
+//
+template <typename In, MultiplyOf<In> Multiply>
+BenchmarkResult benchmarkExecution(const Variant& variant, long size, unsigned threads) {
+  using Out = AccumulatorOf<In>;
+  const unsigned participants = variant.parallel ? threads : 1;
+  std::unique_ptr<ThreadPool> ownPool;
+  usePool(participants, ownPool);
+
+  BasicMatrix<In> m1(size, size);
+  BasicMatrix<In> m2(size, size);
+  BasicMatrix<Out> r(size, size);
+  auto fillInput = [](BasicMatrix<In>& m, long rowBegin, long rowEnd) {
+    if (inputDensity < 1.0) {
+      m.initalizeSparse(inputDensity, rowBegin, rowEnd);
+    }
+    else {
+      m.initalizeRandom(rowBegin, rowEnd);
+    }
+  };
+  placeMatrix(m1, *activePool, [&](long rowBegin, long rowEnd) {
+    fillInput(m1, rowBegin, rowEnd);
+  });
+  placeMatrix(m2, *activePool, [&](long rowBegin, long rowEnd) {
+    fillInput(m2, rowBegin, rowEnd);
+  });
+  placeMatrix(r, *activePool, [&r](long rowBegin, long rowEnd) {
+    r.initalizeZero(rowBegin, rowEnd);
+  });
+
+  BenchmarkResult result;
+  result.kernel = variant.name;
+  result.type = variant.type;
+  result.size = size;
+  result.density = inputDensity;
+  result.threads = participants;
+  result.flops = 2.0 * size * size * size;
+  result.bytes = (2.0 * sizeof(In) + sizeof(Out)) * size * size;
+
+  result.timing = timeRuns(nWarmups, nExecutions, [&] {
+    Multiply(r, m1, m2);
+  });
+  useSharedPool();
+  return result;
 }
 
 //
-// void benchmarkExecution()
+// BenchmarkResult benchmarkBatch<Interleaved>(const Variant &variant,
+//                                            long size, unsigned threads)
 //
-// This is the driver function that runs our little test.  It creates and fills
-// the two test arrays and, via a function pointer, calls the processing
-// function for each algorithm type.
+// Time the multiply of a batch of batchCount size x size matrices.  The
+// interleaved version is multiply_batch() from batch.hpp on the active
+// pool.  The other is what we would do without it: a loop calling the SIMD
+// kernel on one ordinary Matrix after another, which shows what the per
+// call overhead costs at these sizes.
 //
-// Note the signature of the function defines a single argument, a pointer to
-// the function that does the actual work.
+template <bool Interleaved>
+BenchmarkResult benchmarkBatch(const Variant& variant, long size, unsigned threads) {
+  BenchmarkResult result;
+  result.kernel = variant.name;
+  result.type = variant.type;
+  result.size = size;
+  result.batch = batchCount;
+  result.threads = variant.parallel ? threads : 1;
+  result.flops = 2.0 * size * size * size * batchCount;
+  result.bytes = 3.0 * sizeof(float) * size * size * batchCount;
+
+  std::unique_ptr<ThreadPool> ownPool;
+  ThreadPool& pool = usePool(result.threads, ownPool);
+  if (Interleaved) {
+    BatchMatrix<float> a(batchCount, size, size);
+    BatchMatrix<float> b(batchCount, size, size);
+    BatchMatrix<float> c(batchCount, size, size);
+    a.initalizeRandom();
+    b.initalizeRandom();
+    c.initalizeZero();
+    result.timing = timeRuns(nWarmups, nExecutions, [&] {
+      multiply_batch(c, a, b, pool);
+    });
+  }
+  else {
+    std::vector<Matrix> a, b, c;
+    for (long i = 0; i < batchCount; ++i) {
+      a.emplace_back(size, size);
+      b.emplace_back(size, size);
+      c.emplace_back(size, size);
+      a.back().initalizeRandom();
+      b.back().initalizeRandom();
+      c.back().initalizeZero();
+    }
+    result.timing = timeRuns(nWarmups, nExecutions, [&] {
+      for (long i = 0; i < batchCount; ++i) {
+        multiplySimd(c[i], a[i], b[i]);
+      }
+    });
+  }
+  useSharedPool();
+  return result;
+}
+
 //
-void benchmarkExecution(
-  void(*executionFunction)(
-    Matrix& r,
-    long long& elapsed_time,
-    const Matrix& m1,
-    const Matrix& m2))
-{
-  Matrix m1, m2, r;
+// ThreadPool &usePool(unsigned participants, std::unique_ptr<ThreadPool> &own)
+// void useSharedPool()
+//
+// Point activePool, and the Strassen multiply, at a pool with the given
+// number of participants for one benchmark, and back at the shared pool
+// afterwards.  The shared pool is used when it is the right size, unless
+// threads are to be pinned; otherwise a new pool is made and kept in own.
+//
+ThreadPool& usePool(unsigned participants, std::unique_ptr<ThreadPool>& own) {
+  if (pinThreads || participants != sharedPool().size()) {
+    own.reset(new ThreadPool(participants, pinThreads));
+    activePool = own.get();
+  }
+  else {
+    activePool = &sharedPool();
+  }
+  strassen.setPool(*activePool);
+  return *activePool;
+}
 
-  long long total_time = 0.0;
-  for (int i = 0; i < NEXECUTIONS; ++i) {
-    long long elapsed_time = 0.0;
-    m1.initalizeRandom();
-    m2.initalizeRandom();
-    r.initalizeZero();
+void useSharedPool() {
+  activePool = &sharedPool();
+  strassen.setPool(sharedPool());
+}
 
-    executionFunction(r, elapsed_time, m1, m2);
-    total_time += elapsed_time;
+//
+// long ownerOfRow(long row, long rows, unsigned participants)
+// long firstRowOf(long owner, long rows, unsigned participants)
+//
+// The rows of a matrix are shared out among the participants of a pool in
+// equal bands, band p going to participant p.  ownerOfRow() says whose band
+// a row is in, and firstRowOf() where a band starts, so band p is rows
+// firstRowOf(p) to firstRowOf(p + 1) - 1.
+//
+long ownerOfRow(long row, long rows, unsigned participants) {
+  return row * participants / rows;
+}
+
+long firstRowOf(long owner, long rows, unsigned participants) {
+  return (owner * rows + participants - 1) / participants;
+}
+
+//
+// void placeMatrix(BasicMatrix<T> &m, ThreadPool &pool, Fill fill)
+//
+// Fill in m with fill(rowBegin, rowEnd) so that its pages end up where the
+// placement option says.  For first touch (and interleave, where it does
+// no harm) each participant of pool fills in its own band of rows.
+//
+template <typename T, typename Fill>
+void placeMatrix(BasicMatrix<T>& m, ThreadPool& pool, Fill fill) {
+  if (placement == Placement::MAIN) {
+    fill(0, m.rows());
+    return;
+  }
+  if (placement == Placement::INTERLEAVE) {
+    interleaveMemory(m.data(), m.rows() * m.ld() * sizeof(T));
+  }
+  const unsigned participants = pool.size();
+  pool.forEachThread([&](long p) {
+    fill(firstRowOf(p, m.rows(), participants), firstRowOf(p + 1, m.rows(), participants));
+  });
+}
+
+//
+// void printResult(std::ostream &out, const Variant &variant,
+//                  const BenchmarkResult &result)
+//
+// The text report for one measurement.  Besides the times we report the rate
+// in GFLOP/s (a multiply does 2n^3 floating point operations, or integer
+// ones for int8) and how close that gets to the nominal peak of the cores it
+// ran on for that element type, and the rate at which the inputs and result
+// go by, which is what shrinking the element type buys.  The sparse kernels
+// are credited with the 2n^3 operations of the dense multiply, so for them
+// the rate (and the percentage) says how much faster than dense they are
+// rather than how busy they keep the core.
+//
+void printResult(std::ostream& out, const Variant& variant, const BenchmarkResult& result) {
+  const TimingStats& t = result.timing;
+  out << variant.description << " (" << result.type << ", ";
+  if (result.batch > 1) {
+    out << result.batch << " of ";
   }
-  std::cout << "\tAverage execution took\t" << (double) total_time / NEXECUTIONS << " ms" << std::endl;
+  out << result.size << "x" << result.size
+      << ", " << result.threads << (result.threads == 1 ? " thread" : " threads")
+      << ")" << std::endl;
+  out << "\tmin " << t.minNs / 1e6 << " ms, median " << t.medianNs / 1e6
+      << " ms, p95 " << t.p95Ns / 1e6 << " ms, stddev " << t.stddevNs / 1e6
+      << " ms" << std::endl;
+  out << "\tAchieved\t" << result.gflops() << " GFLOP/s";
+  const double peak = variant.peak() * result.threads;
+  if (peak > 0.0) {
+    out << " (" << 100.0 * result.gflops() / peak << "% of peak)";
+  }
+  out << ", " << result.gbytesPerSecond() << " GB/s of operands" << std::endl;
 }
 
-// void multiply(Marix &r, const Matrix &m1, const Matrix& m2)
+// void multiply<T>(BasicMatrix<AccumulatorOf<T>> &r, const BasicMatrix<T> &m1,
+//                  const BasicMatrix<T>& m2)
 //
 // This function implements the algorithm lfor multipling two
 // matrices.   It's single threaded, and just walks through the array
@@ -162,146 +623,230 @@ void benchmarkExecution(
 // algorithm (can you explain why?) and so will not perform well for the large
 // arrays we're using in this program.  Be preapred to wait.
 //
-void multiply(Matrix& r, const Matrix& m1, const Matrix& m2) {
-  for (int i = 0; i < MATRIX_SIZE; ++i) {
-    for (int j = 0; j < MATRIX_SIZE; ++j) {
-      float result = 0.0f;
-      for (int k = 0; k < MATRIX_SIZE; ++k) {
-        const float e1 = m1.elements[i][k];
-        const float e2 = m2.elements[k][j];
+// The products are summed in the accumulator type, so int8 inputs do not
+// overflow and bfloat16 ones are summed in float.
+//
+template <typename T>
+void multiply(BasicMatrix<AccumulatorOf<T>>& r, const BasicMatrix<T>& m1, const BasicMatrix<T>& m2) {
+  using Out = AccumulatorOf<T>;
+  for (long i = 0; i < r.rows(); ++i) {
+    for (long j = 0; j < r.cols(); ++j) {
+      Out result = 0;
+      for (long k = 0; k < m1.cols(); ++k) {
+        const Out e1 = static_cast<Out>(m1(i, k));
+        const Out e2 = static_cast<Out>(m2(k, j));
         result += e1 * e2;
       }
-      r.elements[i][j] = result;
+      r(i, j) = result;
     }
   }
 }
 
 //
-// void singleExecution()
+// void multiplyThreaded(Matrix &r, const Matrix &m1, const Matrix& m2)
 //
-// We're looking at simple process for dealing with the single threaded version
-// of matrix multiply.   We just note the start time,  do the work, and then
-// figure out how the proces took by noting the end time and subtracting.
+// multiplyThreading() on whichever pool is active.
 //
-void singleExecution(Matrix& r,
-                     long long& elapsed_time,
-                     const Matrix& m1,
-                     const Matrix& m2) {
-  //std::cout << "Starting single thread execution..." << std::endl;
-  long long start_time = millisecondsNow();
-
-  //std::cout << "Calculating...." << std::endl;
-  multiply(r, m1, m2);
-
-  long long end_time = millisecondsNow();
-  //std::cout << "Finishing single thread execution..." << std::endl;
+void multiplyThreaded(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  multiplyThreading(r, *activePool, m1, m2);
+}
 
-  elapsed_time = end_time - start_time;
+//
+// void multiplyStrassen(Matrix &r, const Matrix &m1, const Matrix& m2)
+//
+// Strassen-Winograd recursion from strassen.hpp on top of the SIMD kernel.
+//
+void multiplyStrassen(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  strassen.multiply(r, m1, m2);
 }
 
 //
-// void multithreadingExecution()
+// void multiplySparse(Matrix &r, const Matrix &m1, const Matrix& m2)
 //
-// Threre is some setup required to fire-up the different threads.
-// We'll track the different threads in an array, start them by traversing that
-// array, and then joining in turn.
+// m1 in CSR form times m2 with spmm() from sparse.hpp, on the active pool.
+// The conversion is part of the multiply, since the matrices come to us
+// dense; it is one pass over m1, against one pass over m2 for every
+// nonzero of m1.
 //
-void multithreadingExecution(Matrix& r,
-                             long long& elapsed_time,
-                             const Matrix& m1,
-                             const Matrix& m2) {
-  //std::cout << "Starting multithreading execution..." << std::endl;
-  long long startTime = millisecondsNow();
+void multiplySparse(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  spmm(*activePool, r, toCsr(m1), m2);
+}
 
-  std::thread threads[THREADS_NUMBER];
+//
+// void multiplySparseSparse(Matrix &r, const Matrix &m1, const Matrix& m2)
+//
+// Both matrices in CSR form, multiplied with spgemm() and written back out
+// dense.
+//
+void multiplySparseSparse(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  CsrMatrix<float> product;
+  spgemm(*activePool, product, toCsr(m1), toCsr(m2));
+  toDense(r, product);
+}
 
-  for (int i = 0; i < THREADS_NUMBER; ++i) {
-    //std::cout << "Starting thread " << i << std::endl;
-    threads[i] = std::thread(multiplyThreading,
-                             std::ref(r),
-                             i,
-                             std::ref(m1),
-                             std::ref(m2));
+//
+// void multiplyAuto(Matrix &r, const Matrix &m1, const Matrix& m2)
+//
+// Measure how dense m1 is and take the sparse path if calibrateSparse()
+// found it to be faster at that density, the threaded SIMD one if not.
+//
+void multiplyAuto(Matrix& r, const Matrix& m1, const Matrix& m2) {
+  if (preferSparse(density(m1))) {
+    multiplySparse(r, m1, m2);
   }
-
-  //std::cout << "Calculating...." << std::endl;
-
-  for (int i = 0; i < THREADS_NUMBER; ++i) {
-    //std::cout << "Joining thread " << i << std::endl;
-    threads[i].join();
+  else {
+    multiplyThreading(r, *activePool, m1, m2);
   }
-
-  long long endTime = millisecondsNow();
-  //std::cout << "Finishing multithreading execution..." << std::endl;
-
-  elapsed_time = endTime - startTime;
 }
 
 //
-// void multiplyThreading(Matrix& result, const int thread_number, const
-//                              Matrix& m1, const Matrix& m2)
+// void multiplyThreading<In>(BasicMatrix<AccumulatorOf<In>>& result,
+//                            ThreadPool& pool, const BasicMatrix<In>& m1,
+//                            const BasicMatrix<In>& m2)
 //
 // The hard problem for doing matrix multiply in parallel is making certain
 // that threads don't try to work on the same piece of data at the same time.
-// We can arrange the threads to avoid this problem by taking into account the
-// total number of 
-// operations divided by the number of threads.  This tells you the amount of
-// work that you need to do.
-//
-// Thus, we need to figure out where in the array each thread will be
-// operating. We partition the array by treated it as a really long
-// one-dimensional array to simplify the partitioning.  And we then assign work
-// starting with the first thread and then assigning the next thread to the
-// following portion.   Any overhead work that needs to be done will be
-// performed by the first thread.
-//
-// The actual multiplication is performed by taking the partitioning of the
-// array assigned to the thread, remapping into a 2-d array and doing the
-// single-threaded algorithm for that "sub-chunk" of the larger array.
-//
-void multiplyThreading(Matrix& result,
-                        const int thread_number,
-                        const Matrix& m1,
-                        const Matrix& m2) {
-  // Calculate workload
-  const int n_elements = (MATRIX_SIZE * MATRIX_SIZE);
-  const int n_operations = n_elements / THREADS_NUMBER;
-  const int rest_operations = n_elements % THREADS_NUMBER;
-
-  int start_op, end_op;
-
-  if (thread_number == 0) {
-    // First thread does more job
-    start_op = n_operations * thread_number;
-    end_op = (n_operations * (thread_number + 1)) + rest_operations;
-  }
-  else {
-    start_op = n_operations * thread_number + rest_operations;
-    end_op = (n_operations * (thread_number + 1)) + rest_operations;
-  }
-
-  for (int op = start_op; op < end_op; ++op) {
-    const int row = op % MATRIX_SIZE;
-    const int col = op / MATRIX_SIZE;
-    float r = 0.0f;
-    for (int i = 0; i < MATRIX_SIZE; ++i) {
-      const float e1 = m1.elements[row][i];
-      const float e2 = m2.elements[i][col];
-      r += e1 * e2;
+// We can arrange the threads to avoid this problem by giving each one its
+// own piece of the result to fill in.
+//
+// How we cut the result up matters.  Handing out runs of elements that walk
+// down the columns means neighbouring elements of the same row, which share
+// a cache line, belong to different threads, and the line bounces between
+// their caches on every write (false sharing).  So we cut the result into
+// 2-d tiles instead: a band of rows by a band of columns, with the edges
+// lined up on the SIMD kernel's register blocks.  Each tile is a task for
+// the pool, and a tile is worked on by exactly one thread.  We start with
+// big tiles, which reuse the most data, and halve them until there are a
+// few tiles per thread so the work stealing can even out the load.
+//
+// Each tile starts out in the queue of the participant whose band of rows
+// (see ownerOfRow()) it begins in, so with first touch placement a thread
+// mostly writes result rows that sit in its own memory.
+//
+template <typename In>
+void multiplyThreading(BasicMatrix<AccumulatorOf<In>>& result,
+                       ThreadPool& pool,
+                       const BasicMatrix<In>& m1,
+                       const BasicMatrix<In>& m2) {
+  const SimdKernelOf<In>& kernel = simdKernelFor<In>();
+  const long rows = result.rows();
+  const long cols = result.cols();
+  long tileRows = kernel.mr * 16;
+  long tileCols = kernel.nr * 8;
+  auto tiles = [&] {
+    return ((rows + tileRows - 1) / tileRows) * ((cols + tileCols - 1) / tileCols);
+  };
+  while (tiles() < 4L * pool.size() && (tileRows > kernel.mr || tileCols > kernel.nr)) {
+    if (tileCols >= tileRows && tileCols > kernel.nr) {
+      tileCols /= 2;
     }
+    else {
+      tileRows /= 2;
+    }
+  }
+
+  const long tilesAcross = (cols + tileCols - 1) / tileCols;
+  pool.parallelFor(tiles(), [&](long tile) {
+    const long row = (tile / tilesAcross) * tileRows;
+    const long col = (tile % tilesAcross) * tileCols;
+    kernel.multiplyBlock(result, m1, m2,
+                         row, std::min(row + tileRows, rows),
+                         col, std::min(col + tileCols, cols));
+  }, [&](long tile) {
+    return ownerOfRow((tile / tilesAcross) * tileRows, rows, pool.size());
+  });
+}
+
+//
+// void scalingReport(std::ostream &out, long size)
+//
+// Run the multi-threaded multiply on pools of 1, 2, 4, ... threads up to
+// the number of cores and show how the time scales.  Speedup is against
+// one thread; efficiency is speedup divided by the number of threads.
+//
+void scalingReport(std::ostream& out, long size) {
+  Matrix m1(size, size);
+  Matrix m2(size, size);
+  Matrix r(size, size);
+  m1.initalizeRandom();
+  m2.initalizeRandom();
+
+  std::vector<unsigned> counts;
+  for (unsigned t = 1; t < ThreadPool::defaultThreads(); t *= 2) {
+    counts.push_back(t);
+  }
+  counts.push_back(ThreadPool::defaultThreads());
 
-    result.elements[row][col] = r;
+  out << "Scaling (" << size << "x" << size << ", median of "
+      << nExecutions << " runs)" << std::endl;
+  out << "\tthreads\tms\tGFLOP/s\tspeedup\tefficiency" << std::endl;
+  double oneThread = 0.0;
+  for (unsigned threads : counts) {
+    ThreadPool pool(threads, pinThreads);
+    const TimingStats t = timeRuns(nWarmups, nExecutions, [&] {
+      multiplyThreading(r, pool, m1, m2);
+    });
+    if (threads == 1) {
+      oneThread = t.medianNs;
+    }
+    const double speedup = oneThread / t.medianNs;
+    const double n = size;
+    out << "\t" << threads << "\t" << t.medianNs / 1e6 << "\t"
+        << 2.0 * n * n * n / t.medianNs << "\t" << speedup << "\t"
+        << speedup / threads << std::endl;
   }
 }
 
-// long long millisecondsNow()
 //
-// The C++ STL defines classes for processing system time.   Here we use the
-// system_clock::now() funtion to return the number of milliseconds since
-// Jan. 1, 1970 (the start of time according to the UNIX gods).
+// void strassenReport(std::ostream &out, long size)
 //
-long long millisecondsNow() {
-  auto msSinceEpoch = duration_cast<milliseconds>(
-                             system_clock::now().time_since_epoch()).count();
-  return (long long) msSinceEpoch;
-};
+// What Strassen costs in accuracy and buys in speed.  We take the plain
+// multiply() as the reference and compare the SIMD kernel and Strassen with
+// a range of cutoffs against it.  The error is the relative Frobenius norm
+// of the difference, ||C - reference|| / ||reference||.  The GFLOP/s figure
+// counts the 2n^3 operations of a classic multiply, so it shows the speed
+// Strassen would need to match without its trick.
+//
+void strassenReport(std::ostream& out, long size) {
+  Matrix m1(size, size);
+  Matrix m2(size, size);
+  Matrix reference(size, size);
+  Matrix r(size, size);
+  m1.initalizeRandom();
+  m2.initalizeRandom();
+  multiply(reference, m1, m2);
+
+  auto relativeError = [&]() {
+    double difference = 0.0, norm = 0.0;
+    for (long i = 0; i < size; ++i) {
+      for (long j = 0; j < size; ++j) {
+        const double d = (double) r(i, j) - reference(i, j);
+        difference += d * d;
+        norm += (double) reference(i, j) * reference(i, j);
+      }
+    }
+    return norm > 0.0 ? std::sqrt(difference / norm) : std::sqrt(difference);
+  };
+  auto report = [&](const char* name, long cutoff, void (*kernel)(Matrix&, const Matrix&, const Matrix&)) {
+    const TimingStats t = timeRuns(nWarmups, nExecutions, [&] {
+      kernel(r, m1, m2);
+    });
+    const double n = size;
+    out << "\t" << name << "\t";
+    if (cutoff > 0) {
+      out << cutoff;
+    }
+    out << "\t" << t.medianNs / 1e6 << "\t" << 2.0 * n * n * n / t.medianNs
+        << "\t" << relativeError() << std::endl;
+  };
+
+  out << "Strassen accuracy vs speed (" << size << "x" << size << ")" << std::endl;
+  out << "\tkernel\tcutoff\tms\tGFLOP/s\trelative error" << std::endl;
+  report("SIMD", 0, multiplySimd<float>);
+  const long defaultCutoff = strassen.cutoff();
+  for (long cutoff = 64; cutoff < size; cutoff *= 2) {
+    strassen.setCutoff(cutoff);
+    report("Strassen", cutoff, multiplyStrassen);
+  }
+  strassen.setCutoff(defaultCutoff);
+}
@@ -0,0 +1,246 @@
+//
+// File:   matrix.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Storage for the matrices used by the matrix multiply examples.
+//
+#ifndef MATRIX_HPP
+#define MATRIX_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include "bfloat16.hpp"
+
+// We need something to store our matrices.  The first reaction is to use an
+// 2-d array declared as a global or something allocated on a stack.  There are
+// some funky implementation issues with threads we have to address.  Remember
+// that each thread gets it's stack while all threads share the heap.  If we
+// are dealing with large arrays (which is quite realistic in most
+// applications), it is better to use the heap instead
+//
+// Rather than allocating each row on its own (which scatters the rows all
+// over the heap and makes every row change a pointer chase), we keep the
+// whole matrix in one contiguous row-major buffer.  Element (i, j) lives at
+// data[i * ld + j], where the leading dimension ld is the distance between
+// the starts of consecutive rows.  By default ld is the column count rounded
+// up to a whole number of 64 byte cache lines, so with the buffer itself
+// aligned to 64 bytes every row starts on its own cache line.
+//
+// The element type is a template parameter.  Matrix, the one most of the
+// code uses, holds floats; the other element types are there to compare
+// the speed of the same multiply at different precisions.
+//
+// The matrix owns its buffer and frees it when it goes away.  It can be
+// moved but not copied, and resize() keeps the existing buffer when it is
+// already big enough, so a benchmark can reuse the same matrices over and
+// over without going back to the allocator.
+//
+// We add a few help methods for getting a matrix configured.
+
+template <typename T>
+class BasicMatrix {
+public:
+  using value_type = T;
+
+  static const std::size_t ALIGNMENT = 64;
+
+  BasicMatrix() = default;
+
+  BasicMatrix(long rows, long cols, long ld = 0) {
+    resize(rows, cols, ld);
+  }
+
+  BasicMatrix(const BasicMatrix&) = delete;
+  BasicMatrix& operator=(const BasicMatrix&) = delete;
+
+  BasicMatrix(BasicMatrix&& other) noexcept { swap(other); }
+
+  BasicMatrix& operator=(BasicMatrix&& other) noexcept {
+    BasicMatrix gone(std::move(other));
+    swap(gone);
+    return *this;
+  }
+
+  ~BasicMatrix() { std::free(elements); }
+
+  // void resize(long rows, long cols, long ld = 0)
+  //
+  // Change the shape of the matrix.  The contents are unspecified
+  // afterwards.  The buffer is only reallocated if it is too small.
+  //
+  void resize(long rows, long cols, long ld = 0) {
+    const long perLine = ALIGNMENT / sizeof(T);
+    if (ld < cols) {
+      ld = (cols + perLine - 1) / perLine * perLine;
+    }
+    const std::size_t needed = static_cast<std::size_t>(rows) * ld;
+    if (needed > capacity) {
+      std::free(elements);
+      elements = nullptr;
+      capacity = 0;
+      // aligned_alloc wants the size to be a multiple of the alignment
+      std::size_t bytes = (needed * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+      elements = static_cast<T*>(std::aligned_alloc(ALIGNMENT, bytes));
+      if (elements == nullptr) {
+        throw std::bad_alloc();
+      }
+      capacity = needed;
+    }
+    nRows = rows;
+    nCols = cols;
+    leading = ld;
+  }
+
+  long rows() const { return nRows; }
+  long cols() const { return nCols; }
+  long ld() const { return leading; }
+
+  T* data() { return elements; }
+  const T* data() const { return elements; }
+  T* row(long i) { return elements + i * leading; }
+  const T* row(long i) const { return elements + i * leading; }
+
+  T& operator()(long i, long j) { return elements[i * leading + j]; }
+  T operator()(long i, long j) const { return elements[i * leading + j]; }
+
+  // The initialize methods fill rows [rowBegin, rowEnd) of the matrix, all
+  // of them by default.  Filling different rows from different threads is
+  // how the threads get the pages of their rows put in their own memory.
+
+  // void initializeZero(long rowBegin = 0, long rowEnd = -1)
+  //
+  // Fill the matrix with zero.
+  //
+  void initalizeZero(long rowBegin = 0, long rowEnd = -1) {
+    for (long i = rowBegin; i < lastRow(rowEnd); ++i) {
+      T* r = row(i);
+      for (long j = 0; j < nCols; ++j) {
+        r[j] = T(0);
+      }
+    }
+  }
+
+  // void initializeRandom(long rowBegin = 0, long rowEnd = -1)
+  //
+  // Fill the matrix with random values.   Observe the use of
+  // the C++ STL classes for generating random numbers.  This is preferred way
+  // to do this with modern C++.
+  //
+  // Floating point matrices get values in [-1, 1).  Keeping them small
+  // means the products stay well inside the range of every format, and the
+  // rounding error of a result can be read as a relative error.  (Values up
+  // to 1e9 do not even survive the trip into a float: anything past 2^24 has
+  // lost its low digits.)  Integer matrices use their type's whole range.
+  //
+  void initalizeRandom(long rowBegin = 0, long rowEnd = -1) {
+    std::random_device rd;
+    std::mt19937 mt(rd());
+    if constexpr (std::is_integral<T>::value) {
+      std::uniform_int_distribution<int> dist(std::numeric_limits<T>::min(),
+                                              std::numeric_limits<T>::max());
+      auto random = std::bind(dist, mt);
+      for (long i = rowBegin; i < lastRow(rowEnd); ++i) {
+        T* r = row(i);
+        for (long j = 0; j < nCols; ++j) {
+          r[j] = static_cast<T>(random());
+        }
+      }
+    }
+    else {
+      std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+      auto random = std::bind(dist, mt);
+      for (long i = rowBegin; i < lastRow(rowEnd); ++i) {
+        T* r = row(i);
+        for (long j = 0; j < nCols; ++j) {
+          r[j] = T(random());
+        }
+      }
+    }
+  }
+
+  // void initializeSparse(double density, long rowBegin = 0, long rowEnd = -1)
+  //
+  // Fill the matrix like initializeRandom(), then keep each element with
+  // probability density and set the rest to zero.
+  //
+  void initalizeSparse(double density, long rowBegin = 0, long rowEnd = -1) {
+    initalizeRandom(rowBegin, rowEnd);
+    std::random_device rd;
+    std::mt19937 mt(rd());
+    std::bernoulli_distribution keep(density);
+    for (long i = rowBegin; i < lastRow(rowEnd); ++i) {
+      T* r = row(i);
+      for (long j = 0; j < nCols; ++j) {
+        if (!keep(mt)) {
+          r[j] = T(0);
+        }
+      }
+    }
+  }
+
+  // void print()
+  //
+  // And we do have print things.
+  //
+  void print() const {
+    std::cout << std::endl;
+    for (long i = 0; i < nRows; ++i) {
+      std::cout << "|\t";
+
+      for (long j = 0; j < nCols; ++j) {
+        std::cout << +(*this)(i, j) << "\t";
+      }
+      std::cout << "|" << std::endl;
+    }
+  }
+
+  void swap(BasicMatrix& other) noexcept {
+    std::swap(elements, other.elements);
+    std::swap(capacity, other.capacity);
+    std::swap(nRows, other.nRows);
+    std::swap(nCols, other.nCols);
+    std::swap(leading, other.leading);
+  }
+
+private:
+  T* elements = nullptr;
+  std::size_t capacity = 0;
+  long nRows = 0;
+  long nCols = 0;
+  long leading = 0;
+
+  // The end of a row range, where -1 means the last row.
+  long lastRow(long rowEnd) const { return rowEnd < 0 ? nRows : rowEnd; }
+};
+
+using Matrix = BasicMatrix<float>;
+
+// Accumulator<T>::type is what products of two Ts are summed in, and so the
+// element type of the result.  8-bit integers sum into 32 bits, and
+// bfloat16 is only a storage format, so it sums in float.
+template <typename T>
+struct Accumulator {
+  using type = T;
+};
+
+template <>
+struct Accumulator<std::int8_t> {
+  using type = std::int32_t;
+};
+
+template <>
+struct Accumulator<bfloat16> {
+  using type = float;
+};
+
+template <typename T>
+using AccumulatorOf = typename Accumulator<T>::type;
+
+#endif
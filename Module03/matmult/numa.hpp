@@ -0,0 +1,142 @@
+//
+// File:   numa.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Where threads run and where memory lives.
+//
+// On a machine with more than one socket, each socket has its own memory
+// (a NUMA node), and reaching the memory of the other socket costs about
+// twice as much as reaching your own.  Two things decide how often a
+// multiply pays that price:
+//
+//  - Where the threads run.  Left alone, the scheduler moves threads from
+//    core to core, and from socket to socket, as it sees fit, so a thread
+//    can end up far away from the data it was working on.  pinThread()
+//    fixes a thread to one CPU.
+//
+//  - Where the pages are.  Linux puts a page on the node of the thread that
+//    first writes to it ("first touch").  If the main thread fills in every
+//    matrix, all of them end up on its node and the other socket does all
+//    its reading across the interconnect.  Either each thread should fill in
+//    the part of the matrix it will later work on, or, for data everyone
+//    reads, the pages should be spread over all the nodes so the traffic is
+//    at least shared out.  interleaveMemory() asks the kernel for the second
+//    with the mbind() system call.
+//
+// All of this is Linux specific.  Elsewhere, or when the kernel says no, the
+// functions return false and nothing changes, so callers can always fall
+// back to letting the operating system decide.  We make the system call
+// ourselves rather than linking libnuma, so nothing extra is needed to
+// build.
+//
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// std::vector<int> allowedCpus()
+//
+// The CPUs this process may run on, in increasing order.  Empty if we
+// cannot tell.
+//
+inline std::vector<int> allowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+// bool pinThread(unsigned slot)
+//
+// Fix the calling thread to the slot'th allowed CPU (wrapping around if
+// there are more slots than CPUs).  Returns false if it could not be done.
+//
+inline bool pinThread(unsigned slot) {
+#ifdef __linux__
+  static const std::vector<int> cpus = allowedCpus();
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[slot % cpus.size()], &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void) slot;
+  return false;
+#endif
+}
+
+// int numaNodes()
+//
+// How many NUMA nodes the machine has, counted from sysfs.  1 if we cannot
+// tell.
+//
+inline int numaNodes() {
+  int nodes = 0;
+#ifdef __linux__
+  struct stat info;
+  while (nodes < 1024 &&
+         stat(("/sys/devices/system/node/node" + std::to_string(nodes)).c_str(), &info) == 0) {
+    ++nodes;
+  }
+#endif
+  return nodes > 0 ? nodes : 1;
+}
+
+// bool interleaveMemory(void *address, std::size_t bytes)
+//
+// Spread the whole pages in [address, address + bytes) round robin over all
+// the NUMA nodes, moving any that have already been touched.  Returns false
+// if there is only one node, or if the kernel does not support it, in which
+// case the pages stay where first touch puts them.
+//
+inline bool interleaveMemory(void* address, std::size_t bytes) {
+#if defined(__linux__) && defined(SYS_mbind)
+  const int nodes = numaNodes();
+  if (nodes < 2) {
+    return false;
+  }
+  const int MPOL_INTERLEAVE_ = 3;
+  const unsigned MPOL_MF_MOVE_ = 1u << 1;
+  const std::uintptr_t page = sysconf(_SC_PAGESIZE);
+  const std::uintptr_t begin = (reinterpret_cast<std::uintptr_t>(address) + page - 1) / page * page;
+  const std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(address) + bytes) / page * page;
+  if (end <= begin) {
+    return false;
+  }
+  const std::size_t bitsPerWord = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask((nodes + bitsPerWord - 1) / bitsPerWord, 0);
+  for (int node = 0; node < nodes; ++node) {
+    mask[node / bitsPerWord] |= 1ul << (node % bitsPerWord);
+  }
+  return syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE_, mask.data(),
+                 nodes + 1, MPOL_MF_MOVE_) == 0;
+#else
+  (void) address;
+  (void) bytes;
+  return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,587 @@
+//
+// File:   simdgemm.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Register-blocked SIMD matrix multiply with runtime instruction set
+// selection.
+//
+// This is the structure used by the fast BLAS libraries.  The blocked
+// kernel in gemm.hpp keeps tiles in cache, but it still loads and stores a
+// piece of the result for every multiply-add.  Here the work is cut down to
+// a tiny MR x NR block of the result that lives entirely in SIMD registers
+// while the micro-kernel runs all the way along the k dimension, so the
+// inner loop is nothing but loads of A and B and fused multiply-adds.
+//
+// To feed the micro-kernel with unit-stride loads, the driver first packs
+// the current KC x NC panel of m2 into NR-wide slivers and the current
+// MC x KC block of m1 into MR-tall slivers.  Slivers at the ragged edges
+// are padded with zeros, and the result of an edge block is computed into
+// a scratch block and only the valid part copied out.
+//
+// Packing is also where the element type gets sorted out.  Each kernel is
+// described by a small "ops" struct: the type it wants its packed operands
+// in, the type it accumulates in, its register block, and how many steps of
+// k it consumes at once.  The driver converts the input while packing, so
+// the same float kernels serve bfloat16 inputs (widened to float as they are
+// packed), and the integer kernels get their 8-bit inputs laid out in the
+// groups of 2 or 4 their dot-product instructions expect.
+//
+// The micro-kernels are
+//   float     AVX-512 6 x 32, AVX2+FMA 6 x 16, scalar 4 x 8
+//   double    AVX-512 6 x 16, AVX2+FMA 6 x 8,  scalar 4 x 8
+//   bfloat16  the float kernels, accumulating in float
+//   int8      AVX-512 VNNI 6 x 32, AVX2 6 x 16, scalar 4 x 8, into int32
+// and simdKernelFor<T>() picks the best one the CPU supports (using CPUID
+// through the GCC/Clang builtins) the first time it is asked.
+//
+#ifndef SIMDGEMM_HPP
+#define SIMDGEMM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include "matrix.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMDGEMM_X86 1
+#endif
+
+// What every ops struct has unless it says otherwise: one step of k per
+// packed value, inputs converted with a plain cast, and nothing extra
+// stored after a packed B sliver.
+template <typename PackedT, typename OutT>
+struct KernelOps {
+  using Packed = PackedT;
+  using Out = OutT;
+  static const int KG = 1;
+  static const long B_EXTRA = 0;
+
+  template <typename In>
+  static Packed convertA(In x) { return static_cast<Packed>(x); }
+  template <typename In>
+  static Packed convertB(In x) { return static_cast<Packed>(x); }
+  template <typename In>
+  static void finishB(const In*, long, long, long, Packed*) {}
+};
+
+// Portable micro-kernel for any type: C[MR x NR] += A sliver * B sliver.
+template <typename PackedT, typename OutT, int MRows, int NCols>
+struct ScalarOps : KernelOps<PackedT, OutT> {
+  static const int MR = MRows;
+  static const int NR = NCols;
+
+  static void kernel(long steps, const PackedT* a, const PackedT* b, OutT* c, long ldc) {
+    OutT acc[MR][NR] = {};
+    for (long p = 0; p < steps; ++p) {
+      for (int i = 0; i < MR; ++i) {
+        const OutT ai = a[p * MR + i];
+        for (int j = 0; j < NR; ++j) {
+          acc[i][j] += ai * static_cast<OutT>(b[p * NR + j]);
+        }
+      }
+    }
+    for (int i = 0; i < MR; ++i) {
+      for (int j = 0; j < NR; ++j) {
+        c[i * ldc + j] += acc[i][j];
+      }
+    }
+  }
+};
+
+#ifdef SIMDGEMM_X86
+// float, 6 x 16: each row of the block is two ymm registers.
+struct FloatAVX2Ops : KernelOps<float, float> {
+  static const int MR = 6;
+  static const int NR = 16;
+
+  __attribute__((target("avx2,fma")))
+  static void kernel(long steps, const float* a, const float* b, float* c, long ldc) {
+    __m256 acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+      acc[i][0] = _mm256_setzero_ps();
+      acc[i][1] = _mm256_setzero_ps();
+    }
+    for (long p = 0; p < steps; ++p) {
+      const __m256 b0 = _mm256_loadu_ps(b + p * 16);
+      const __m256 b1 = _mm256_loadu_ps(b + p * 16 + 8);
+      for (int i = 0; i < 6; ++i) {
+        const __m256 ai = _mm256_broadcast_ss(a + p * 6 + i);
+        acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+      }
+    }
+    for (int i = 0; i < 6; ++i) {
+      float* ci = c + i * ldc;
+      _mm256_storeu_ps(ci, _mm256_add_ps(_mm256_loadu_ps(ci), acc[i][0]));
+      _mm256_storeu_ps(ci + 8, _mm256_add_ps(_mm256_loadu_ps(ci + 8), acc[i][1]));
+    }
+  }
+};
+
+// float, 6 x 32: each row of the block is two zmm registers.
+struct FloatAVX512Ops : KernelOps<float, float> {
+  static const int MR = 6;
+  static const int NR = 32;
+
+  __attribute__((target("avx512f")))
+  static void kernel(long steps, const float* a, const float* b, float* c, long ldc) {
+    __m512 acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+      acc[i][0] = _mm512_setzero_ps();
+      acc[i][1] = _mm512_setzero_ps();
+    }
+    for (long p = 0; p < steps; ++p) {
+      const __m512 b0 = _mm512_loadu_ps(b + p * 32);
+      const __m512 b1 = _mm512_loadu_ps(b + p * 32 + 16);
+      for (int i = 0; i < 6; ++i) {
+        const __m512 ai = _mm512_set1_ps(a[p * 6 + i]);
+        acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+      }
+    }
+    for (int i = 0; i < 6; ++i) {
+      float* ci = c + i * ldc;
+      _mm512_storeu_ps(ci, _mm512_add_ps(_mm512_loadu_ps(ci), acc[i][0]));
+      _mm512_storeu_ps(ci + 16, _mm512_add_ps(_mm512_loadu_ps(ci + 16), acc[i][1]));
+    }
+  }
+};
+
+// double, 6 x 8: each row of the block is two ymm registers.
+struct DoubleAVX2Ops : KernelOps<double, double> {
+  static const int MR = 6;
+  static const int NR = 8;
+
+  __attribute__((target("avx2,fma")))
+  static void kernel(long steps, const double* a, const double* b, double* c, long ldc) {
+    __m256d acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+      acc[i][0] = _mm256_setzero_pd();
+      acc[i][1] = _mm256_setzero_pd();
+    }
+    for (long p = 0; p < steps; ++p) {
+      const __m256d b0 = _mm256_loadu_pd(b + p * 8);
+      const __m256d b1 = _mm256_loadu_pd(b + p * 8 + 4);
+      for (int i = 0; i < 6; ++i) {
+        const __m256d ai = _mm256_broadcast_sd(a + p * 6 + i);
+        acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+        acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+      }
+    }
+    for (int i = 0; i < 6; ++i) {
+      double* ci = c + i * ldc;
+      _mm256_storeu_pd(ci, _mm256_add_pd(_mm256_loadu_pd(ci), acc[i][0]));
+      _mm256_storeu_pd(ci + 4, _mm256_add_pd(_mm256_loadu_pd(ci + 4), acc[i][1]));
+    }
+  }
+};
+
+// double, 6 x 16: each row of the block is two zmm registers.
+struct DoubleAVX512Ops : KernelOps<double, double> {
+  static const int MR = 6;
+  static const int NR = 16;
+
+  __attribute__((target("avx512f")))
+  static void kernel(long steps, const double* a, const double* b, double* c, long ldc) {
+    __m512d acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+      acc[i][0] = _mm512_setzero_pd();
+      acc[i][1] = _mm512_setzero_pd();
+    }
+    for (long p = 0; p < steps; ++p) {
+      const __m512d b0 = _mm512_loadu_pd(b + p * 16);
+      const __m512d b1 = _mm512_loadu_pd(b + p * 16 + 8);
+      for (int i = 0; i < 6; ++i) {
+        const __m512d ai = _mm512_set1_pd(a[p * 6 + i]);
+        acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+        acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+      }
+    }
+    for (int i = 0; i < 6; ++i) {
+      double* ci = c + i * ldc;
+      _mm512_storeu_pd(ci, _mm512_add_pd(_mm512_loadu_pd(ci), acc[i][0]));
+      _mm512_storeu_pd(ci + 8, _mm512_add_pd(_mm512_loadu_pd(ci + 8), acc[i][1]));
+    }
+  }
+};
+
+// int8 -> int32, 6 x 16 with AVX2.  The inputs are widened to 16 bits and
+// packed in pairs along k, so that vpmaddwd can multiply a pair from a row
+// of A by the matching pair from each of 8 columns of B and add the two
+// products into one 32-bit lane.
+struct Int8AVX2Ops : KernelOps<std::int16_t, std::int32_t> {
+  static const int MR = 6;
+  static const int NR = 16;
+  static const int KG = 2;
+
+  __attribute__((target("avx2")))
+  static void kernel(long steps, const std::int16_t* a, const std::int16_t* b,
+                     std::int32_t* c, long ldc) {
+    __m256i acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+      acc[i][0] = _mm256_setzero_si256();
+      acc[i][1] = _mm256_setzero_si256();
+    }
+    for (long p = 0; p < steps; ++p) {
+      const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + p * 32));
+      const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + p * 32 + 16));
+      for (int i = 0; i < 6; ++i) {
+        std::int32_t pair;
+        std::memcpy(&pair, a + (p * 6 + i) * 2, sizeof(pair));
+        const __m256i ai = _mm256_set1_epi32(pair);
+        acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(ai, b0));
+        acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(ai, b1));
+      }
+    }
+    for (int i = 0; i < 6; ++i) {
+      __m256i* ci = reinterpret_cast<__m256i*>(c + i * ldc);
+      _mm256_storeu_si256(ci, _mm256_add_epi32(_mm256_loadu_si256(ci), acc[i][0]));
+      _mm256_storeu_si256(ci + 1, _mm256_add_epi32(_mm256_loadu_si256(ci + 1), acc[i][1]));
+    }
+  }
+};
+
+// int8 -> int32, 6 x 32 with AVX-512 VNNI.  vpdpbusd multiplies groups of
+// four bytes along k and adds all four products into a 32-bit lane, so it
+// does 64 multiply-adds per instruction.  The catch is that it multiplies
+// unsigned bytes by signed ones.  So A is packed with 128 added (flipping
+// the top bit does that), which makes it unsigned, and the extra
+// 128 * (sum of the column of B) is taken back off at the end.  Those
+// column sums are worked out while B is packed and stored after the sliver.
+struct Int8VNNIOps : KernelOps<std::int8_t, std::int32_t> {
+  static const int MR = 6;
+  static const int NR = 32;
+  static const int KG = 4;
+  static const long B_EXTRA = NR * sizeof(std::int32_t);
+
+  template <typename In>
+  static std::int8_t convertA(In x) {
+    return static_cast<std::int8_t>(static_cast<std::uint8_t>(x) ^ 0x80u);
+  }
+
+  template <typename In>
+  static void finishB(const In* b, long ldb, long kc, long cols, std::int8_t* extra) {
+    for (long j = 0; j < NR; ++j) {
+      std::int32_t sum = 0;
+      for (long p = 0; j < cols && p < kc; ++p) {
+        sum += b[p * ldb + j];
+      }
+      sum *= 128;
+      std::memcpy(extra + j * sizeof(sum), &sum, sizeof(sum));
+    }
+  }
+
+  __attribute__((target("avx512f,avx512bw,avx512vnni")))
+  static void kernel(long steps, const std::int8_t* a, const std::int8_t* b,
+                     std::int32_t* c, long ldc) {
+    __m512i acc[6][2];
+    for (int i = 0; i < 6; ++i) {
+      acc[i][0] = _mm512_setzero_si512();
+      acc[i][1] = _mm512_setzero_si512();
+    }
+    for (long p = 0; p < steps; ++p) {
+      const __m512i b0 = _mm512_loadu_si512(b + p * 128);
+      const __m512i b1 = _mm512_loadu_si512(b + p * 128 + 64);
+      for (int i = 0; i < 6; ++i) {
+        std::int32_t quad;
+        std::memcpy(&quad, a + (p * 6 + i) * 4, sizeof(quad));
+        const __m512i ai = _mm512_set1_epi32(quad);
+        acc[i][0] = _mm512_dpbusd_epi32(acc[i][0], ai, b0);
+        acc[i][1] = _mm512_dpbusd_epi32(acc[i][1], ai, b1);
+      }
+    }
+    const __m512i correction0 = _mm512_loadu_si512(b + steps * 128);
+    const __m512i correction1 = _mm512_loadu_si512(b + steps * 128 + 64);
+    for (int i = 0; i < 6; ++i) {
+      std::int32_t* ci = c + i * ldc;
+      const __m512i r0 = _mm512_sub_epi32(acc[i][0], correction0);
+      const __m512i r1 = _mm512_sub_epi32(acc[i][1], correction1);
+      _mm512_storeu_si512(ci, _mm512_add_epi32(_mm512_loadu_si512(ci), r0));
+      _mm512_storeu_si512(ci + 16, _mm512_add_epi32(_mm512_loadu_si512(ci + 16), r1));
+    }
+  }
+};
+#endif
+
+// Packed values in one sliver for kc steps of k, padded to whole groups.
+template <typename Ops>
+long groupedSteps(long kc) {
+  return (kc + Ops::KG - 1) / Ops::KG;
+}
+
+// void packA<Ops>(const In*, long, long, long, Packed*)
+//
+// Copy rows x kc of A (row stride lda) into one MR-tall sliver.  For each
+// group of KG steps of k, the sliver holds the group for row 0, then for
+// row 1, and so on.
+//
+template <typename Ops, typename In>
+void packA(const In* a, long lda, long rows, long kc, typename Ops::Packed* packed) {
+  const long groups = groupedSteps<Ops>(kc);
+  for (long g = 0; g < groups; ++g) {
+    for (long i = 0; i < Ops::MR; ++i) {
+      for (long q = 0; q < Ops::KG; ++q) {
+        const long p = g * Ops::KG + q;
+        *packed++ = Ops::convertA(i < rows && p < kc ? a[i * lda + p] : In(0));
+      }
+    }
+  }
+}
+
+// void packB<Ops>(const In*, long, long, long, Packed*)
+//
+// Copy kc x cols of B (row stride ldb) into one NR-wide sliver, laid out
+// like packA() with columns in place of rows.  Padding is always zero.
+//
+template <typename Ops, typename In>
+void packB(const In* b, long ldb, long kc, long cols, typename Ops::Packed* packed) {
+  const long groups = groupedSteps<Ops>(kc);
+  for (long g = 0; g < groups; ++g) {
+    for (long j = 0; j < Ops::NR; ++j) {
+      for (long q = 0; q < Ops::KG; ++q) {
+        const long p = g * Ops::KG + q;
+        *packed++ = j < cols && p < kc ? Ops::convertB(b[p * ldb + j])
+                                       : typename Ops::Packed(0);
+      }
+    }
+  }
+  Ops::finishB(b, ldb, kc, cols, packed);
+}
+
+// void gemmPacked<In, Ops>(long m, long n, long k,
+//                          const In* a, long lda,
+//                          const In* b, long ldb,
+//                          Out* c, long ldc)
+//
+// C = A * B where A is m x k, B is k x n and C is m x n, each given as a
+// pointer to its first element and the distance between its rows.  This is
+// the packing driver around the micro-kernel in Ops.  Nothing outside of C
+// is written, so different threads can work on different blocks of the same
+// result.  The packing buffers belong to the calling thread and are reused
+// from call to call.
+//
+template <typename In, typename Ops>
+void gemmPacked(long m, long n, long k,
+                const In* a, long lda,
+                const In* b, long ldb,
+                typename Ops::Out* c, long ldc) {
+  using Packed = typename Ops::Packed;
+  using Out = typename Ops::Out;
+  const long MR = Ops::MR;
+  const long NR = Ops::NR;
+  const long MC = MR * 16;
+  const long KC = 256;
+  const long NC = NR * 64;
+  const long aSliver = MR * groupedSteps<Ops>(KC) * Ops::KG;
+  const long bSliver = NR * groupedSteps<Ops>(KC) * Ops::KG + Ops::B_EXTRA;
+
+  thread_local BasicMatrix<Packed> packedA, packedB;
+  packedA.resize(1, MC / MR * aSliver);
+  packedB.resize(1, NC / NR * bSliver);
+  Packed* bufA = packedA.data();
+  Packed* bufB = packedB.data();
+
+  for (long i = 0; i < m; ++i) {
+    std::fill(c + i * ldc, c + i * ldc + n, Out(0));
+  }
+  for (long jc = 0; jc < n; jc += NC) {
+    const long nc = std::min(NC, n - jc);
+    for (long pc = 0; pc < k; pc += KC) {
+      const long kc = std::min(KC, k - pc);
+      const long steps = groupedSteps<Ops>(kc);
+      for (long jr = 0; jr < nc; jr += NR) {
+        packB<Ops>(b + pc * ldb + jc + jr, ldb, kc, std::min(NR, nc - jr),
+                   bufB + jr / NR * bSliver);
+      }
+      for (long ic = 0; ic < m; ic += MC) {
+        const long mc = std::min(MC, m - ic);
+        for (long ir = 0; ir < mc; ir += MR) {
+          packA<Ops>(a + (ic + ir) * lda + pc, lda, std::min(MR, mc - ir), kc,
+                     bufA + ir / MR * aSliver);
+        }
+        for (long jr = 0; jr < nc; jr += NR) {
+          const long cols = std::min(NR, nc - jr);
+          for (long ir = 0; ir < mc; ir += MR) {
+            const long rows = std::min(MR, mc - ir);
+            Out* cBlock = c + (ic + ir) * ldc + jc + jr;
+            const Packed* aSliverPtr = bufA + ir / MR * aSliver;
+            const Packed* bSliverPtr = bufB + jr / NR * bSliver;
+            if (rows == MR && cols == NR) {
+              Ops::kernel(steps, aSliverPtr, bSliverPtr, cBlock, ldc);
+            }
+            else {
+              Out edge[Ops::MR * Ops::NR] = {};
+              Ops::kernel(steps, aSliverPtr, bSliverPtr, edge, NR);
+              for (long i = 0; i < rows; ++i) {
+                for (long j = 0; j < cols; ++j) {
+                  cBlock[i * ldc + j] += edge[i * NR + j];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// void multiplyPackedBlock<In, Ops>(BasicMatrix<Out> &r,
+//                                   const BasicMatrix<In> &m1,
+//                                   const BasicMatrix<In>& m2, long rowBegin,
+//                                   long rowEnd, long colBegin, long colEnd)
+//
+// Compute just the block of r = m1 * m2 with rows [rowBegin, rowEnd) and
+// columns [colBegin, colEnd).
+//
+template <typename In, typename Ops>
+void multiplyPackedBlock(BasicMatrix<typename Ops::Out>& r,
+                         const BasicMatrix<In>& m1, const BasicMatrix<In>& m2,
+                         long rowBegin, long rowEnd, long colBegin, long colEnd) {
+  gemmPacked<In, Ops>(rowEnd - rowBegin, colEnd - colBegin, m1.cols(),
+                      m1.row(rowBegin), m1.ld(),
+                      m2.data() + colBegin, m2.ld(),
+                      r.row(rowBegin) + colBegin, r.ld());
+}
+
+// void multiplyPacked<In, Ops>(BasicMatrix<Out> &r, const BasicMatrix<In> &m1,
+//                              const BasicMatrix<In>& m2)
+//
+// r = m1 * m2, all of it.
+//
+template <typename In, typename Ops>
+void multiplyPacked(BasicMatrix<typename Ops::Out>& r,
+                    const BasicMatrix<In>& m1, const BasicMatrix<In>& m2) {
+  multiplyPackedBlock<In, Ops>(r, m1, m2, 0, m1.rows(), 0, m2.cols());
+}
+
+// What the dispatcher settled on for inputs of type In.  flopsPerCycle is
+// the nominal single core peak for the instruction set (operations rather
+// than flops for the integer kernels), assuming two vector units.  mr x nr
+// is the register block, so blocks handed to multiplyBlock are best made
+// multiples of it.
+template <typename In>
+struct SimdKernelOf {
+  using Out = AccumulatorOf<In>;
+
+  const char* name;
+  void (*multiply)(BasicMatrix<Out>& r, const BasicMatrix<In>& m1, const BasicMatrix<In>& m2);
+  void (*multiplyBlock)(BasicMatrix<Out>& r, const BasicMatrix<In>& m1, const BasicMatrix<In>& m2,
+                        long rowBegin, long rowEnd, long colBegin, long colEnd);
+  void (*gemm)(long m, long n, long k, const In* a, long lda,
+               const In* b, long ldb, Out* c, long ldc);
+  int mr;
+  int nr;
+  int flopsPerCycle;
+};
+
+using SimdKernel = SimdKernelOf<float>;
+
+template <typename In, typename Ops>
+SimdKernelOf<In> makeSimdKernel(const char* name, int flopsPerCycle) {
+  static_assert(std::is_same<typename Ops::Out, AccumulatorOf<In>>::value,
+                "kernel accumulates in the wrong type");
+  return {name, multiplyPacked<In, Ops>, multiplyPackedBlock<In, Ops>,
+          gemmPacked<In, Ops>, Ops::MR, Ops::NR, flopsPerCycle};
+}
+
+// const SimdKernelOf<In> &simdKernelFor<In>()
+//
+// The widest micro-kernel this CPU can run for inputs of type In, chosen
+// once.
+//
+template <typename In>
+const SimdKernelOf<In>& simdKernelFor() {
+  static const SimdKernelOf<In> chosen = []() -> SimdKernelOf<In> {
+#ifdef SIMDGEMM_X86
+    __builtin_cpu_init();
+    const bool avx512 = __builtin_cpu_supports("avx512f");
+    const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if constexpr (std::is_same<In, float>::value || std::is_same<In, bfloat16>::value) {
+      if (avx512) {
+        return makeSimdKernel<In, FloatAVX512Ops>("AVX-512", 64);
+      }
+      if (avx2) {
+        return makeSimdKernel<In, FloatAVX2Ops>("AVX2+FMA", 32);
+      }
+    }
+    else if constexpr (std::is_same<In, double>::value) {
+      if (avx512) {
+        return makeSimdKernel<In, DoubleAVX512Ops>("AVX-512", 32);
+      }
+      if (avx2) {
+        return makeSimdKernel<In, DoubleAVX2Ops>("AVX2+FMA", 16);
+      }
+    }
+    else if constexpr (std::is_same<In, std::int8_t>::value) {
+      if (avx512 && __builtin_cpu_supports("avx512bw") &&
+          __builtin_cpu_supports("avx512vnni")) {
+        return makeSimdKernel<In, Int8VNNIOps>("AVX-512 VNNI", 256);
+      }
+      if (avx2) {
+        return makeSimdKernel<In, Int8AVX2Ops>("AVX2", 64);
+      }
+    }
+#endif
+    using Out = AccumulatorOf<In>;
+    const int lanes = std::max<int>(1, 16 / sizeof(Out));
+    return makeSimdKernel<In, ScalarOps<Out, Out, 4, 8>>("scalar", 2 * lanes);
+  }();
+  return chosen;
+}
+
+// const SimdKernel &simdKernel()
+//
+// The float kernel, which is the one most of the program uses.
+//
+inline const SimdKernel& simdKernel() {
+  return simdKernelFor<float>();
+}
+
+// void multiplySimd<In>(BasicMatrix<Out> &r, const BasicMatrix<In> &m1,
+//                       const BasicMatrix<In>& m2)
+//
+// Multiply with the micro-kernel picked by simdKernelFor<In>().
+//
+template <typename In>
+void multiplySimd(BasicMatrix<AccumulatorOf<In>>& r,
+                  const BasicMatrix<In>& m1, const BasicMatrix<In>& m2) {
+  simdKernelFor<In>().multiply(r, m1, m2);
+}
+
+// double cpuGHz()
+//
+// Best guess at the clock speed: the maximum frequency from cpufreq if the
+// kernel exposes it, otherwise the current speed from /proc/cpuinfo.
+// Returns 0 if neither is available.
+//
+inline double cpuGHz() {
+  std::ifstream maxFreq("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+  double khz = 0.0;
+  if (maxFreq >> khz && khz > 0.0) {
+    return khz / 1e6;
+  }
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 7, "cpu MHz") == 0) {
+      return std::stod(line.substr(line.find(':') + 1)) / 1e3;
+    }
+  }
+  return 0.0;
+}
+
+// double peakGflops<In>()
+//
+// Nominal single core peak for the kernel chosen for In, or 0 if we could
+// not tell the clock speed.
+//
+template <typename In = float>
+double peakGflops() {
+  return cpuGHz() * simdKernelFor<In>().flopsPerCycle;
+}
+
+#endif
@@ -0,0 +1,390 @@
+//
+// File:   sparse.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Sparse matrices and the kernels that multiply them.
+//
+// When most of a matrix is zeros, the dense multiply spends nearly all of
+// its time multiplying by zero.  A sparse format keeps only the nonzeros:
+//
+//   CSR (compressed sparse row) stores the nonzeros row by row.  For row i,
+//   entries rowStart[i] ... rowStart[i + 1] - 1 of column and value give
+//   the column and value of each nonzero, in increasing column order.
+//
+//   CSC (compressed sparse column) is the same thing column by column.  The
+//   CSC form of a matrix has exactly the arrays of the CSR form of its
+//   transpose, which is how the two are converted.
+//
+// The kernels all work row by row and run in parallel across rows on a
+// ThreadPool.  The rows are cut into bands holding about the same number of
+// nonzeros, rather than the same number of rows, so a few heavy rows do not
+// leave one thread doing all the work.  Every band writes only its own rows
+// of the result.
+//
+//   spmv()    y = A * x, sparse matrix times dense vector
+//   spmm()    R = A * B, sparse matrix times dense matrix
+//   spgemm()  C = A * B, sparse times sparse giving sparse (Gustavson's
+//             row by row algorithm)
+//
+// Whether sparse pays off depends on the density.  The sparse kernels do far
+// fewer operations, but each one is slower than in the packed SIMD kernel
+// since they cannot be blocked for registers the same way.
+// calibrateSparse() measures both on a probe multiply at startup to find the
+// density where they cross, and preferSparse() compares a matrix's measured
+// density against that.
+//
+#ifndef SPARSE_HPP
+#define SPARSE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include "matrix.hpp"
+#include "simdgemm.hpp"
+#include "threadpool.hpp"
+
+template <typename T>
+struct CsrMatrix {
+  long rows = 0;
+  long cols = 0;
+  std::vector<long> rowStart;
+  std::vector<long> column;
+  std::vector<T> value;
+
+  long nonzeros() const { return value.size(); }
+};
+
+template <typename T>
+struct CscMatrix {
+  long rows = 0;
+  long cols = 0;
+  std::vector<long> colStart;
+  std::vector<long> row;
+  std::vector<T> value;
+
+  long nonzeros() const { return value.size(); }
+};
+
+// double density(const BasicMatrix<T> &m)
+//
+// The fraction of the elements of m that are not zero.
+//
+template <typename T>
+double density(const BasicMatrix<T>& m) {
+  if (m.rows() == 0 || m.cols() == 0) {
+    return 0.0;
+  }
+  long nonzeros = 0;
+  for (long i = 0; i < m.rows(); ++i) {
+    const T* r = m.row(i);
+    for (long j = 0; j < m.cols(); ++j) {
+      nonzeros += r[j] != T(0);
+    }
+  }
+  return static_cast<double>(nonzeros) / (static_cast<double>(m.rows()) * m.cols());
+}
+
+// CsrMatrix<T> toCsr(const BasicMatrix<T> &m)
+//
+// The nonzeros of m in CSR form.
+//
+template <typename T>
+CsrMatrix<T> toCsr(const BasicMatrix<T>& m) {
+  CsrMatrix<T> a;
+  a.rows = m.rows();
+  a.cols = m.cols();
+  a.rowStart.assign(a.rows + 1, 0);
+  for (long i = 0; i < a.rows; ++i) {
+    const T* r = m.row(i);
+    for (long j = 0; j < a.cols; ++j) {
+      if (r[j] != T(0)) {
+        a.column.push_back(j);
+        a.value.push_back(r[j]);
+      }
+    }
+    a.rowStart[i + 1] = a.column.size();
+  }
+  return a;
+}
+
+// void toDense(BasicMatrix<T> &m, const CsrMatrix<T> &a)
+//
+// Write a out in full.  m must already be a.rows x a.cols.
+//
+template <typename T>
+void toDense(BasicMatrix<T>& m, const CsrMatrix<T>& a) {
+  m.initalizeZero();
+  for (long i = 0; i < a.rows; ++i) {
+    T* r = m.row(i);
+    for (long p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p) {
+      r[a.column[p]] = a.value[p];
+    }
+  }
+}
+
+// void transposeCompressed(long outer, long inner, ...)
+//
+// Turn the compressed arrays of an outer x inner matrix (one start per
+// outer index, an inner index for each nonzero) into those of its
+// transpose.  A counting sort on the inner index, so the output indices come
+// out in increasing order.
+//
+template <typename T>
+void transposeCompressed(long outer, long inner,
+                         const std::vector<long>& start, const std::vector<long>& index,
+                         const std::vector<T>& value,
+                         std::vector<long>& tStart, std::vector<long>& tIndex,
+                         std::vector<T>& tValue) {
+  tStart.assign(inner + 1, 0);
+  for (long k : index) {
+    ++tStart[k + 1];
+  }
+  std::partial_sum(tStart.begin(), tStart.end(), tStart.begin());
+  tIndex.resize(index.size());
+  tValue.resize(value.size());
+  std::vector<long> next(tStart.begin(), tStart.end() - 1);
+  for (long o = 0; o < outer; ++o) {
+    for (long p = start[o]; p < start[o + 1]; ++p) {
+      const long q = next[index[p]]++;
+      tIndex[q] = o;
+      tValue[q] = value[p];
+    }
+  }
+}
+
+template <typename T>
+CscMatrix<T> toCsc(const CsrMatrix<T>& a) {
+  CscMatrix<T> b;
+  b.rows = a.rows;
+  b.cols = a.cols;
+  transposeCompressed(a.rows, a.cols, a.rowStart, a.column, a.value,
+                      b.colStart, b.row, b.value);
+  return b;
+}
+
+template <typename T>
+CsrMatrix<T> toCsr(const CscMatrix<T>& b) {
+  CsrMatrix<T> a;
+  a.rows = b.rows;
+  a.cols = b.cols;
+  transposeCompressed(b.cols, b.rows, b.colStart, b.row, b.value,
+                      a.rowStart, a.column, a.value);
+  return a;
+}
+
+// std::vector<long> rowBands(const std::vector<long> &rowStart, long parts)
+//
+// Cut the rows into at most parts bands with about the same number of
+// nonzeros each.  Band b is rows [bands[b], bands[b + 1]).
+//
+inline std::vector<long> rowBands(const std::vector<long>& rowStart, long parts) {
+  const long rows = rowStart.size() - 1;
+  const long total = rowStart.back();
+  std::vector<long> bands(1, 0);
+  for (long b = 1; b < parts; ++b) {
+    const long target = total * b / parts;
+    const long row = std::upper_bound(rowStart.begin(), rowStart.end() - 1, target) -
+                     rowStart.begin() - 1;
+    if (row > bands.back() && row < rows) {
+      bands.push_back(row);
+    }
+  }
+  bands.push_back(rows);
+  return bands;
+}
+
+// void forEachBand(ThreadPool &pool, const std::vector<long> &rowStart,
+//                  Body body)
+//
+// Call body(rowBegin, rowEnd) for each band of rows, in parallel.
+//
+template <typename Body>
+void forEachBand(ThreadPool& pool, const std::vector<long>& rowStart, Body body) {
+  const std::vector<long> bands = rowBands(rowStart, 4L * pool.size());
+  pool.parallelFor(bands.size() - 1, [&](long b) {
+    body(bands[b], bands[b + 1]);
+  });
+}
+
+// void spmv(ThreadPool &pool, const CsrMatrix<T> &a, const T *x, T *y)
+//
+// y = a * x.  x has a.cols elements and y has a.rows.
+//
+template <typename T>
+void spmv(ThreadPool& pool, const CsrMatrix<T>& a, const T* x, T* y) {
+  forEachBand(pool, a.rowStart, [&](long rowBegin, long rowEnd) {
+    for (long i = rowBegin; i < rowEnd; ++i) {
+      T sum = T(0);
+      for (long p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p) {
+        sum += a.value[p] * x[a.column[p]];
+      }
+      y[i] = sum;
+    }
+  });
+}
+
+// void spmv(ThreadPool &pool, const CscMatrix<T> &a, const T *x, T *y)
+//
+// y = a * x with a stored by columns.  Each task still owns a band of the
+// rows of y: it walks every column, using the sorted row indices to jump
+// straight to the part of the column that falls in its band.
+//
+template <typename T>
+void spmv(ThreadPool& pool, const CscMatrix<T>& a, const T* x, T* y) {
+  const long parts = std::min<long>(4L * pool.size(), std::max(a.rows, 1L));
+  pool.parallelFor(parts, [&](long b) {
+    const long rowBegin = a.rows * b / parts;
+    const long rowEnd = a.rows * (b + 1) / parts;
+    std::fill(y + rowBegin, y + rowEnd, T(0));
+    for (long j = 0; j < a.cols; ++j) {
+      const auto first = a.row.begin() + a.colStart[j];
+      const auto last = a.row.begin() + a.colStart[j + 1];
+      for (auto p = std::lower_bound(first, last, rowBegin); p != last && *p < rowEnd; ++p) {
+        y[*p] += a.value[p - a.row.begin()] * x[j];
+      }
+    }
+  });
+}
+
+// void spmm(ThreadPool &pool, BasicMatrix<T> &r, const CsrMatrix<T> &a,
+//           const BasicMatrix<T> &b)
+//
+// r = a * b with b and r dense.  Each nonzero a(i, k) adds a(i, k) times
+// row k of b to row i of r; both rows are contiguous, so the inner loop
+// vectorizes.  r must already be a.rows x b.cols.
+//
+template <typename T>
+void spmm(ThreadPool& pool, BasicMatrix<T>& r, const CsrMatrix<T>& a, const BasicMatrix<T>& b) {
+  const long n = b.cols();
+  forEachBand(pool, a.rowStart, [&](long rowBegin, long rowEnd) {
+    for (long i = rowBegin; i < rowEnd; ++i) {
+      T* ri = r.row(i);
+      std::fill(ri, ri + n, T(0));
+      for (long p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p) {
+        const T aik = a.value[p];
+        const T* bk = b.row(a.column[p]);
+        for (long j = 0; j < n; ++j) {
+          ri[j] += aik * bk[j];
+        }
+      }
+    }
+  });
+}
+
+// void spgemm(ThreadPool &pool, CsrMatrix<T> &c, const CsrMatrix<T> &a,
+//             const CsrMatrix<T> &b)
+//
+// c = a * b, all sparse.  Row i of c is the sum of the rows of b picked out
+// by the nonzeros of row i of a, so it is built by scattering those rows
+// into a dense accumulator as wide as b.  It takes two passes: the first
+// only counts the nonzeros of each row of c so that the arrays can be laid
+// out, the second fills them in.  Each band has its own accumulator.
+//
+template <typename T>
+void spgemm(ThreadPool& pool, CsrMatrix<T>& c, const CsrMatrix<T>& a, const CsrMatrix<T>& b) {
+  c.rows = a.rows;
+  c.cols = b.cols;
+  c.rowStart.assign(a.rows + 1, 0);
+
+  forEachBand(pool, a.rowStart, [&](long rowBegin, long rowEnd) {
+    std::vector<long> seen(b.cols, -1);
+    for (long i = rowBegin; i < rowEnd; ++i) {
+      long count = 0;
+      for (long p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p) {
+        const long k = a.column[p];
+        for (long q = b.rowStart[k]; q < b.rowStart[k + 1]; ++q) {
+          if (seen[b.column[q]] != i) {
+            seen[b.column[q]] = i;
+            ++count;
+          }
+        }
+      }
+      c.rowStart[i + 1] = count;
+    }
+  });
+  std::partial_sum(c.rowStart.begin(), c.rowStart.end(), c.rowStart.begin());
+  c.column.resize(c.rowStart.back());
+  c.value.resize(c.rowStart.back());
+
+  forEachBand(pool, a.rowStart, [&](long rowBegin, long rowEnd) {
+    std::vector<long> seen(b.cols, -1);
+    std::vector<T> sum(b.cols, T(0));
+    for (long i = rowBegin; i < rowEnd; ++i) {
+      long* columns = c.column.data() + c.rowStart[i];
+      long count = 0;
+      for (long p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p) {
+        const long k = a.column[p];
+        const T aik = a.value[p];
+        for (long q = b.rowStart[k]; q < b.rowStart[k + 1]; ++q) {
+          const long j = b.column[q];
+          if (seen[j] != i) {
+            seen[j] = i;
+            columns[count++] = j;
+            sum[j] = T(0);
+          }
+          sum[j] += aik * b.value[q];
+        }
+      }
+      std::sort(columns, columns + count);
+      T* values = c.value.data() + c.rowStart[i];
+      for (long q = 0; q < count; ++q) {
+        values[q] = sum[columns[q]];
+      }
+    }
+  });
+}
+
+// The density below which preferSparse() says to go sparse, until
+// calibrateSparse() measures a better one.
+inline double& sparseCrossover() {
+  static double crossover = 0.1;
+  return crossover;
+}
+
+// bool preferSparse(double density)
+//
+// Whether a multiply with a left operand this dense is faster done sparse.
+//
+inline bool preferSparse(double density) {
+  return density < sparseCrossover();
+}
+
+// void calibrateSparse(long probeSize, std::ostream &log = std::cout)
+//
+// Time the SIMD kernel and spmm() on one thread on probeSize x probeSize
+// matrices, spmm() on a left operand with 1% nonzeros, and set the
+// crossover to the density at which spmm() would take as long as the dense
+// multiply.  spmm() time grows in proportion to the nonzeros, so one probe
+// is enough.  The result is reported on log.
+//
+inline void calibrateSparse(long probeSize, std::ostream& log = std::cout) {
+  const double probeDensity = 0.01;
+  Matrix a(probeSize, probeSize), b(probeSize, probeSize), c(probeSize, probeSize);
+  a.initalizeSparse(probeDensity);
+  b.initalizeRandom();
+  const CsrMatrix<float> sparse = toCsr(a);
+  ThreadPool one(1);
+
+  auto fastest = [](auto work) {
+    double best = 0.0;
+    for (int run = 0; run < 3; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      work();
+      std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+      if (run == 0 || took.count() < best) {
+        best = took.count();
+      }
+    }
+    return best;
+  };
+  const double dense = fastest([&] { simdKernel().multiply(c, a, b); });
+  const double perDensity = fastest([&] { spmm(one, c, sparse, b); }) /
+                            std::max(density(a), 1e-6);
+  sparseCrossover() = std::min(1.0, dense / perDensity);
+  log << "Sparse multiply pays off below " << 100.0 * sparseCrossover()
+      << "% nonzeros" << std::endl;
+}
+
+#endif
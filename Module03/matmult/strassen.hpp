@@ -0,0 +1,299 @@
+//
+// File:   strassen.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// Strassen-Winograd matrix multiply for big matrices.
+//
+// Cut each matrix into four quarters.  The obvious way to multiply them takes
+// eight quarter-sized multiplies.  Strassen noticed that, at the price of a
+// handful of extra additions, seven are enough; Winograd's variant gets the
+// additions down to fifteen.  Doing that recursively makes the multiply
+// O(n^2.81) instead of O(n^3).  Additions are only O(n^2), but they are
+// memory bound while the multiply kernel is not, so below some size the
+// classic kernel wins and the recursion stops there and hands the pieces to
+// the SIMD kernel from simdgemm.hpp.  That size is the cutoff, and the best
+// value depends on the machine.
+//
+// With A = [A11 A12; A21 A22] and B the same, Winograd's form is
+//
+//   S1 = A21 + A22   S2 = S1 - A11    S3 = A11 - A21   S4 = A12 - S2
+//   T1 = B12 - B11   T2 = B22 - T1    T3 = B22 - B12   T4 = T2 - B21
+//
+//   M1 = A11 B11     M2 = A12 B21     M3 = S4 B22      M4 = A22 T4
+//   M5 = S1 T1       M6 = S2 T2       M7 = S3 T3
+//
+//   C11 = M1 + M2              C12 = M1 + M6 + M5 + M3
+//   C21 = M1 + M6 + M7 - M4    C22 = M1 + M6 + M7 + M5
+//
+// The seven products are independent of each other, so on the first few
+// levels of the recursion they run as parallel tasks on the thread pool.
+// Below that they run one after another, reusing one set of temporaries.
+//
+// All the temporaries come out of a workspace that is sized and allocated
+// before the recursion starts, so the recursion itself never goes to the
+// allocator.  Each level carves what it needs off the front and passes the
+// rest down; the parallel levels give each of their seven tasks a separate
+// piece.
+//
+// A matrix with an odd dimension cannot be cut in half, so we multiply the
+// largest even-sized part with the recursion and do the leftover row, column
+// and rank-one update by hand ("dynamic peeling").
+//
+// Strassen trades some accuracy for speed: the extra additions and
+// subtractions lose more to rounding than the classic dot products, and the
+// error grows with the depth of the recursion.
+//
+#ifndef STRASSEN_HPP
+#define STRASSEN_HPP
+
+#include <algorithm>
+#include "matrix.hpp"
+#include "simdgemm.hpp"
+#include "threadpool.hpp"
+
+class Strassen {
+public:
+  static const long DEFAULT_CUTOFF = 256;
+
+  // parallelLevels is how many levels of the recursion spread their
+  // products over the pool; -1 means one level if the pool has more than
+  // one thread, and none otherwise.
+  explicit Strassen(ThreadPool& pool, long cutoff = DEFAULT_CUTOFF, int parallelLevels = -1)
+    : pool(&pool), requestedLevels(parallelLevels) {
+    setCutoff(cutoff);
+  }
+
+  long cutoff() const { return leafSize; }
+
+  // Below (or at) this size in any dimension we use the classic kernel.
+  void setCutoff(long cutoff) { leafSize = std::max(cutoff, 16L); }
+
+  void setParallelLevels(int levels) { requestedLevels = levels; }
+
+  // Run the parallel levels on a different pool from now on.
+  void setPool(ThreadPool& newPool) { pool = &newPool; }
+
+  // void multiply(Matrix &r, const Matrix &m1, const Matrix& m2)
+  //
+  // r = m1 * m2.  The workspace grows here if this multiply needs more than
+  // any before it, and is kept for next time.
+  //
+  void multiply(Matrix& r, const Matrix& m1, const Matrix& m2) {
+    const long m = m1.rows();
+    const long k = m1.cols();
+    const long n = m2.cols();
+    parallelDepth = requestedLevels >= 0 ? requestedLevels : (pool->size() > 1 ? 1 : 0);
+    const long needed = workspaceSize(m, k, n, 0);
+    if (needed > 0 && (workspace.cols() < needed)) {
+      workspace.resize(1, needed);
+    }
+    recurse(Block{r.data(), m, n, r.ld()},
+            ConstBlock{m1.data(), m, k, m1.ld()},
+            ConstBlock{m2.data(), k, n, m2.ld()},
+            workspace.data(), 0);
+  }
+
+private:
+  // A rectangular piece of some matrix, and a read-only one.
+  template <typename T>
+  struct BlockOf {
+    T* data;
+    long rows;
+    long cols;
+    long ld;
+
+    BlockOf part(long row, long col, long nRows, long nCols) const {
+      return BlockOf{data + row * ld + col, nRows, nCols, ld};
+    }
+    T* row(long i) const { return data + i * ld; }
+  };
+  using Block = BlockOf<float>;
+  using ConstBlock = BlockOf<const float>;
+
+  static ConstBlock constant(const Block& b) {
+    return ConstBlock{b.data, b.rows, b.cols, b.ld};
+  }
+
+  ThreadPool* pool;
+  int requestedLevels;
+  int parallelDepth = 0;
+  long leafSize;
+  Matrix workspace;
+
+  // Temporaries keep their rows on separate cache lines just like Matrix.
+  static long paddedCols(long cols) {
+    const long perLine = Matrix::ALIGNMENT / sizeof(float);
+    return (cols + perLine - 1) / perLine * perLine;
+  }
+
+  static long tempSize(long rows, long cols) {
+    return rows * paddedCols(cols);
+  }
+
+  static Block takeTemp(float*& space, long rows, long cols) {
+    Block b{space, rows, cols, paddedCols(cols)};
+    space += tempSize(rows, cols);
+    return b;
+  }
+
+  bool isLeaf(long m, long k, long n) const {
+    return std::min(std::min(m, k), n) <= leafSize;
+  }
+
+  // long workspaceSize(long m, long k, long n, int depth)
+  //
+  // How many floats recurse() will carve out of the workspace for this
+  // multiply.  This has to follow recurse() step for step.
+  //
+  long workspaceSize(long m, long k, long n, int depth) const {
+    if (isLeaf(m, k, n)) {
+      return 0;
+    }
+    if ((m | k | n) & 1) {
+      return workspaceSize(m & ~1L, k & ~1L, n & ~1L, depth);
+    }
+    const long mh = m / 2, kh = k / 2, nh = n / 2;
+    const long operands = 4 * tempSize(mh, kh) + 4 * tempSize(kh, nh);
+    const long below = workspaceSize(mh, kh, nh, depth + 1);
+    if (depth < parallelDepth) {
+      return operands + 7 * tempSize(mh, nh) + 7 * below;
+    }
+    return operands + tempSize(mh, nh) + below;
+  }
+
+  // dst = x + sign * y
+  static void combine(Block dst, ConstBlock x, ConstBlock y, float sign) {
+    for (long i = 0; i < dst.rows; ++i) {
+      float* __restrict d = dst.row(i);
+      const float* xi = x.row(i);
+      const float* yi = y.row(i);
+      for (long j = 0; j < dst.cols; ++j) {
+        d[j] = xi[j] + sign * yi[j];
+      }
+    }
+  }
+
+  // dst += sign * x
+  static void accumulate(Block dst, ConstBlock x, float sign) {
+    for (long i = 0; i < dst.rows; ++i) {
+      float* __restrict d = dst.row(i);
+      const float* xi = x.row(i);
+      for (long j = 0; j < dst.cols; ++j) {
+        d[j] += sign * xi[j];
+      }
+    }
+  }
+
+  static void leaf(Block c, ConstBlock a, ConstBlock b) {
+    simdKernel().gemm(c.rows, c.cols, a.cols, a.data, a.ld, b.data, b.ld, c.data, c.ld);
+  }
+
+  // void recurse(Block c, ConstBlock a, ConstBlock b, float* space, int depth)
+  //
+  // c = a * b, taking temporaries from space.
+  //
+  void recurse(Block c, ConstBlock a, ConstBlock b, float* space, int depth) {
+    const long m = a.rows, k = a.cols, n = b.cols;
+    if (isLeaf(m, k, n)) {
+      leaf(c, a, b);
+      return;
+    }
+    if ((m | k | n) & 1) {
+      peel(c, a, b, space, depth);
+      return;
+    }
+
+    const long mh = m / 2, kh = k / 2, nh = n / 2;
+    const ConstBlock A11 = a.part(0, 0, mh, kh), A12 = a.part(0, kh, mh, kh);
+    const ConstBlock A21 = a.part(mh, 0, mh, kh), A22 = a.part(mh, kh, mh, kh);
+    const ConstBlock B11 = b.part(0, 0, kh, nh), B12 = b.part(0, nh, kh, nh);
+    const ConstBlock B21 = b.part(kh, 0, kh, nh), B22 = b.part(kh, nh, kh, nh);
+    Block C11 = c.part(0, 0, mh, nh), C12 = c.part(0, nh, mh, nh);
+    Block C21 = c.part(mh, 0, mh, nh), C22 = c.part(mh, nh, mh, nh);
+
+    Block S1 = takeTemp(space, mh, kh), S2 = takeTemp(space, mh, kh);
+    Block S3 = takeTemp(space, mh, kh), S4 = takeTemp(space, mh, kh);
+    Block T1 = takeTemp(space, kh, nh), T2 = takeTemp(space, kh, nh);
+    Block T3 = takeTemp(space, kh, nh), T4 = takeTemp(space, kh, nh);
+    combine(S1, A21, A22, 1.0f);
+    combine(S2, constant(S1), A11, -1.0f);
+    combine(S3, A11, A21, -1.0f);
+    combine(S4, A12, constant(S2), -1.0f);
+    combine(T1, B12, B11, -1.0f);
+    combine(T2, B22, constant(T1), -1.0f);
+    combine(T3, B22, B12, -1.0f);
+    combine(T4, constant(T2), B21, -1.0f);
+
+    const ConstBlock left[7] = {A11, A12, constant(S4), A22,
+                                constant(S1), constant(S2), constant(S3)};
+    const ConstBlock right[7] = {B11, B21, B22, constant(T4),
+                                 constant(T1), constant(T2), constant(T3)};
+
+    if (depth < parallelDepth) {
+      Block M[7];
+      for (Block& product : M) {
+        product = takeTemp(space, mh, nh);
+      }
+      const long below = workspaceSize(mh, kh, nh, depth + 1);
+      pool->parallelFor(7, [&](long i) {
+        recurse(M[i], left[i], right[i], space + i * below, depth + 1);
+      });
+      combine(C11, constant(M[0]), constant(M[1]), 1.0f);
+      accumulate(M[5], constant(M[0]), 1.0f);        // M6 = U2 = M1 + M6
+      combine(C12, constant(M[5]), constant(M[4]), 1.0f);
+      accumulate(C12, constant(M[2]), 1.0f);
+      accumulate(M[5], constant(M[6]), 1.0f);        // M6 = U3 = U2 + M7
+      combine(C21, constant(M[5]), constant(M[3]), -1.0f);
+      combine(C22, constant(M[5]), constant(M[4]), 1.0f);
+      return;
+    }
+
+    // One after another, building the quarters of c in place with a single
+    // extra temporary P.
+    Block P = takeTemp(space, mh, nh);
+    recurse(P, left[0], right[0], space, depth + 1);        // P = M1
+    recurse(C22, left[5], right[5], space, depth + 1);      // C22 = M6
+    accumulate(C22, constant(P), 1.0f);                     // C22 = U2
+    recurse(C11, left[1], right[1], space, depth + 1);      // C11 = M2
+    accumulate(C11, constant(P), 1.0f);                     // C11 done
+    recurse(C21, left[6], right[6], space, depth + 1);      // C21 = M7
+    accumulate(C21, constant(C22), 1.0f);                   // C21 = U3
+    recurse(P, left[4], right[4], space, depth + 1);        // P = M5
+    combine(C12, constant(C22), constant(P), 1.0f);         // C12 = U4
+    combine(C22, constant(C21), constant(P), 1.0f);         // C22 done
+    recurse(P, left[2], right[2], space, depth + 1);        // P = M3
+    accumulate(C12, constant(P), 1.0f);                     // C12 done
+    recurse(P, left[3], right[3], space, depth + 1);        // P = M4
+    accumulate(C21, constant(P), -1.0f);                    // C21 done
+  }
+
+  // void peel(Block c, ConstBlock a, ConstBlock b, float* space, int depth)
+  //
+  // Recurse on the even-sized part, then fix up the odd row, column and
+  // inner dimension.
+  //
+  void peel(Block c, ConstBlock a, ConstBlock b, float* space, int depth) {
+    const long m = a.rows, k = a.cols, n = b.cols;
+    const long me = m & ~1L, ke = k & ~1L, ne = n & ~1L;
+    recurse(c.part(0, 0, me, ne), a.part(0, 0, me, ke), b.part(0, 0, ke, ne), space, depth);
+    if (ke < k) {
+      // The last column of a times the last row of b.
+      for (long i = 0; i < me; ++i) {
+        const float ai = a.row(i)[ke];
+        const float* bk = b.row(ke);
+        float* ci = c.row(i);
+        for (long j = 0; j < ne; ++j) {
+          ci[j] += ai * bk[j];
+        }
+      }
+    }
+    if (ne < n) {
+      leaf(c.part(0, ne, m, 1), a, b.part(0, ne, k, 1));
+    }
+    if (me < m) {
+      leaf(c.part(me, 0, 1, ne), a.part(me, 0, 1, k), b.part(0, 0, k, ne));
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,273 @@
+//
+// File:   threadpool.hpp
+// Author: Adam.Lewis@athens.edu
+// Purpose:
+// A persistent work-stealing thread pool for the matrix multiply examples.
+//
+// Starting a thread costs tens of microseconds.  For a small multiply that is
+// more than the multiply itself, so if we start fresh threads on every call
+// the benchmark ends up timing thread creation.  The pool starts its workers
+// once and keeps them around, asleep when there is nothing to do.
+//
+// Every participant has its own queue of tasks.  A thread pushes and pops
+// at the back of its own queue, so it tends to work on the tasks it just
+// made, whose data is still in its cache.  When its queue runs dry it steals
+// from the front of somebody else's, which is where the oldest (and usually
+// biggest) pieces of work are.  Each queue sits on its own cache line so the
+// threads are not fighting over one lock.
+//
+// The pool counts the thread that calls parallelFor() as one of its
+// participants: a pool of size N has N - 1 workers, and the caller works
+// through the queues alongside them until its tasks are done.  That also
+// makes it safe to call parallelFor() from inside a task.
+//
+// On a big machine it matters which thread does which piece of work (see
+// numa.hpp).  A pinned pool fixes each worker to its own CPU, and tasks can
+// be given a home: parallelFor() with a home function puts each task in the
+// queue of the participant it names, where it runs unless somebody runs out
+// of work and steals it.  forEachThread() goes one step further and runs one
+// task on each participant with no stealing at all, which is what is needed
+// to decide where memory pages end up.
+//
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "numa.hpp"
+
+class ThreadPool {
+public:
+  // Worker i of a pinned pool runs only on the i'th CPU the process may
+  // use.  Participant 0 is whoever calls parallelFor(), so pinning that
+  // thread (to CPU slot 0, with pinThread()) is up to the caller.
+  explicit ThreadPool(unsigned threads = defaultThreads(), bool pinned = false)
+    : queues(std::max(threads, 1u)) {
+    for (unsigned i = 1; i < queues.size(); ++i) {
+      workers.emplace_back([this, i, pinned] {
+        if (pinned) {
+          pinThread(i);
+        }
+        run(i);
+      });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    workReady.notify_all();
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Number of threads that work on a parallelFor(), the caller included.
+  unsigned size() const { return queues.size(); }
+
+  static unsigned defaultThreads() {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  // void parallelFor(long count, Body body)
+  //
+  // Run body(0) ... body(count - 1) on the pool and return when all of
+  // them have finished.
+  //
+  template <typename Body>
+  void parallelFor(long count, Body&& body) {
+    const unsigned self = ownQueue();
+    submit(count, body, [self](long) { return self; }, false);
+  }
+
+  // void parallelFor(long count, Body body, Home home)
+  //
+  // The same, but body(i) is queued on participant home(i) % size().
+  //
+  template <typename Body, typename Home>
+  void parallelFor(long count, Body&& body, Home&& home) {
+    submit(count, body, home, false);
+  }
+
+  // void forEachThread(Body body)
+  //
+  // Run body(p) on participant p, for every p in [0, size()), and return
+  // when all of them have finished.
+  //
+  template <typename Body>
+  void forEachThread(Body&& body) {
+    submit(size(), body, [](long p) { return p; }, true);
+  }
+
+private:
+  struct Task {
+    std::function<void()> run;
+    std::atomic<long>* pending;
+  };
+
+  // Tasks that others may steal, and tasks that only the owner may run.
+  struct alignas(64) Queue {
+    std::mutex lock;
+    std::deque<Task*> tasks;
+    std::deque<Task*> bound;
+    std::atomic<long> boundCount{0};
+  };
+
+  std::vector<Queue> queues;
+  std::vector<std::thread> workers;
+  std::atomic<long> queued{0};
+  std::mutex sleepMutex;
+  std::condition_variable workReady;
+  bool stopping = false;
+
+  // Which queue belongs to the calling thread: a worker's own, or queue 0
+  // for any thread from outside the pool.
+  unsigned ownQueue() const {
+    return owner() == this ? index() : 0;
+  }
+
+  static const ThreadPool*& owner() {
+    thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+
+  static unsigned& index() {
+    thread_local unsigned queue = 0;
+    return queue;
+  }
+
+  // void submit(long count, Body &body, Home home, bool bound)
+  //
+  // Queue body(0) ... body(count - 1), task i on participant home(i), and
+  // help run tasks until all of them are done.  Bound tasks can only be run
+  // by the participant they were queued on.
+  //
+  template <typename Body, typename Home>
+  void submit(long count, Body& body, Home home, bool bound) {
+    if (count <= 0) {
+      return;
+    }
+    std::atomic<long> pending(count);
+    std::vector<Task> tasks(count);
+    for (long i = 0; i < count; ++i) {
+      tasks[i].run = [&body, i] { body(i); };
+      tasks[i].pending = &pending;
+    }
+
+    for (long i = 0; i < count;) {
+      const unsigned target = home(i) % queues.size();
+      Queue& queue = queues[target];
+      std::lock_guard<std::mutex> lock(queue.lock);
+      for (; i < count && home(i) % queues.size() == target; ++i) {
+        if (bound) {
+          queue.bound.push_back(&tasks[i]);
+          queue.boundCount.fetch_add(1);
+        }
+        else {
+          queue.tasks.push_back(&tasks[i]);
+          queued.fetch_add(1);
+        }
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    workReady.notify_all();
+
+    const unsigned self = ownQueue();
+    while (pending.load(std::memory_order_acquire) > 0) {
+      if (Task* task = findTask(self)) {
+        execute(task);
+      }
+      else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Whether there is anything findTask(self) could return.
+  bool hasWork(unsigned self) const {
+    return queued.load(std::memory_order_relaxed) > 0 ||
+           queues[self].boundCount.load(std::memory_order_relaxed) > 0;
+  }
+
+  // Task *findTask(unsigned self)
+  //
+  // A task bound to us, or the newest task in our own queue, or failing
+  // those the oldest one we can steal from another.
+  //
+  Task* findTask(unsigned self) {
+    if (!hasWork(self)) {
+      return nullptr;
+    }
+    for (unsigned k = 0; k < queues.size(); ++k) {
+      Queue& queue = queues[(self + k) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.lock);
+      if (k == 0 && !queue.bound.empty()) {
+        Task* task = queue.bound.front();
+        queue.bound.pop_front();
+        queue.boundCount.fetch_sub(1);
+        return task;
+      }
+      if (!queue.tasks.empty()) {
+        Task* task;
+        if (k == 0) {
+          task = queue.tasks.back();
+          queue.tasks.pop_back();
+        }
+        else {
+          task = queue.tasks.front();
+          queue.tasks.pop_front();
+        }
+        queued.fetch_sub(1);
+        return task;
+      }
+    }
+    return nullptr;
+  }
+
+  static void execute(Task* task) {
+    std::atomic<long>* pending = task->pending;
+    task->run();
+    pending->fetch_sub(1, std::memory_order_release);
+  }
+
+  void run(unsigned self) {
+    owner() = this;
+    index() = self;
+    while (true) {
+      if (Task* task = findTask(self)) {
+        execute(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      workReady.wait(lock, [this, self] { return stopping || hasWork(self); });
+      if (stopping && !hasWork(self)) {
+        return;
+      }
+    }
+  }
+};
+
+// ThreadPool &sharedPool()
+//
+// One pool, one thread per core, for everyone to use.
+//
+inline ThreadPool& sharedPool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+#endif
@@ -0,0 +1,349 @@
+//
+// File:   mmureplay.cpp
+// Author: Your Glorious Instructor
+// Purpose:
+// Trace-driven benchmark for the MMU cache.  Reads an address trace (or
+// generates a synthetic one) and replays it against every combination of
+// cache size and replacement policy, reporting the hit rate, the simulated
+// time spent waiting on secondary storage, and the wall time of the run.
+// The storage delay runs on a VirtualClock, so a million accesses take
+// seconds instead of days.
+//
+// Usage:
+//   mmureplay FILE                  replay a trace file
+//   mmureplay --zipf N [ALPHA]      N accesses, Zipf distributed addresses
+//   mmureplay --scan N [LENGTH]     N accesses, sequential scans
+//   mmureplay --loop N [SIZE]       N accesses, looping over a working set
+// Any of the generators can be followed by --save FILE to keep the trace.
+//
+// Trace files are either text, one access per line as "R addr", "W addr",
+// or just "addr" for a read, or the binary format written by
+// MemMgtUnit::dumpTrace() (see mmustats.hpp).  Files ending in .bin are
+// saved in the binary format.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "memmgtunit.hpp"
+
+struct Access
+{
+    std::size_t address;
+    bool write;
+};
+using Trace = std::vector<Access>;
+
+// Fraction of generated accesses that are writes
+const double WRITE_FRACTION = 0.2;
+
+//
+// bool loadTrace(const std::string &, Trace &)
+// Read a text or binary trace file.  Addresses outside the simulated
+// memory wrap around.
+//
+bool loadTrace(const std::string &path, Trace &trace)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+    char magic[sizeof(AccessTrace::MAGIC)] = {};
+    in.read(magic, sizeof(magic));
+    if (in && std::memcmp(magic, AccessTrace::MAGIC, sizeof(magic)) == 0)
+    {
+        std::uint64_t count = 0;
+        in.read(reinterpret_cast<char *>(&count), sizeof(count));
+        TraceRecord record;
+        for (std::uint64_t i = 0; i < count; ++i)
+        {
+            if (!in.read(reinterpret_cast<char *>(&record), sizeof(record)))
+            {
+                return false;
+            }
+            trace.push_back({record.address % MEMSIZE, record.op == TraceRecord::Write});
+        }
+        return true;
+    }
+
+    in.clear();
+    in.seekg(0);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first) || first[0] == '#')
+        {
+            continue;
+        }
+        bool write = false;
+        std::string address = first;
+        if (first == "R" || first == "r" || first == "W" || first == "w")
+        {
+            write = (first == "W" || first == "w");
+            if (!(fields >> address))
+            {
+                return false;
+            }
+        }
+        trace.push_back({std::stoull(address, nullptr, 0) % MEMSIZE, write});
+    }
+    return true;
+}
+
+//
+// bool saveTrace(const std::string &, const Trace &)
+// Write a trace in the binary format if the name ends in .bin, and as
+// text otherwise.
+//
+bool saveTrace(const std::string &path, const Trace &trace)
+{
+    const bool binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+    std::ofstream out(path, binary ? std::ios::binary : std::ios::out);
+    if (!out)
+    {
+        return false;
+    }
+    if (binary)
+    {
+        const std::uint64_t count = trace.size();
+        out.write(AccessTrace::MAGIC, sizeof(AccessTrace::MAGIC));
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        std::uint64_t tick = 0;
+        for (const Access &access : trace)
+        {
+            TraceRecord record{tick++, access.address,
+                               access.write ? TraceRecord::Write : TraceRecord::Read, 0, {}};
+            out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+        }
+    }
+    else
+    {
+        for (const Access &access : trace)
+        {
+            out << (access.write ? "W " : "R ") << access.address << '\n';
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+//
+// Synthetic trace generators.  Each one decides which address comes next;
+// every access is then a write with probability WRITE_FRACTION.
+//
+template <typename NextAddress>
+Trace generate(std::size_t count, NextAddress next)
+{
+    std::mt19937_64 gen{415};
+    std::bernoulli_distribution isWrite(WRITE_FRACTION);
+    Trace trace;
+    trace.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        trace.push_back({next(gen, i), isWrite(gen)});
+    }
+    return trace;
+}
+
+//
+// Trace zipfTrace(std::size_t, double)
+// Address k (counting from 0) is picked with probability proportional to
+// 1 / (k + 1)^alpha, so a handful of addresses get most of the traffic.
+//
+Trace zipfTrace(std::size_t count, double alpha)
+{
+    std::vector<double> cdf(MEMSIZE);
+    double total = 0.0;
+    for (std::size_t k = 0; k < cdf.size(); ++k)
+    {
+        total += 1.0 / std::pow(static_cast<double>(k + 1), alpha);
+        cdf[k] = total;
+    }
+    std::uniform_real_distribution<double> ud(0.0, total);
+    return generate(count, [&](std::mt19937_64 &gen, std::size_t) {
+        return static_cast<std::size_t>(std::lower_bound(cdf.begin(), cdf.end(), ud(gen)) - cdf.begin());
+    });
+}
+
+//
+// Trace scanTrace(std::size_t, std::size_t)
+// Walk through `length` consecutive addresses, then start over somewhere
+// else.
+//
+Trace scanTrace(std::size_t count, std::size_t length)
+{
+    std::size_t base = 0;
+    std::uniform_int_distribution<std::size_t> ud(0, MEMSIZE - 1);
+    return generate(count, [&](std::mt19937_64 &gen, std::size_t i) {
+        if (i % length == 0)
+        {
+            base = ud(gen);
+        }
+        return (base + i % length) % MEMSIZE;
+    });
+}
+
+//
+// Trace loopTrace(std::size_t, std::size_t)
+// Go round and round the same `size` addresses.
+//
+Trace loopTrace(std::size_t count, std::size_t size)
+{
+    return generate(count, [&](std::mt19937_64 &, std::size_t i) {
+        return i % size % MEMSIZE;
+    });
+}
+
+//
+// void replay<Lines, Replacement>(const Trace &, const char *)
+// Run the trace through a fully associative cache of the given size and
+// policy and print one row of the report.
+//
+template <std::size_t Lines, typename Replacement>
+void replay(const Trace &trace, const char *policy)
+{
+    FullyAssociativeMemMgtUnit<Lines, Replacement, VirtualClock> unit;
+    unit.seed(415);
+    const auto start = std::chrono::steady_clock::now();
+    int value = 0;
+    for (const Access &access : trace)
+    {
+        if (access.write)
+        {
+            unit.set(access.address, ++value);
+        }
+        else
+        {
+            unit.get(access.address);
+        }
+    }
+    unit.flush();
+    const auto end = std::chrono::steady_clock::now();
+
+    const CacheCounters counters = unit.stats();
+    std::cout << std::setw(6) << Lines << "  " << std::setw(6) << policy
+              << std::fixed << std::setprecision(4)
+              << std::setw(10) << counters.hitRate()
+              << std::setprecision(1)
+              << std::setw(16) << unit.clock().elapsed().count() / 1000.0
+              << std::setprecision(3)
+              << std::setw(12) << std::chrono::duration<double>(end - start).count()
+              << std::endl;
+}
+
+template <std::size_t Lines>
+void replayPolicies(const Trace &trace)
+{
+    replay<Lines, LRUReplacement>(trace, "LRU");
+    replay<Lines, ClockReplacement>(trace, "CLOCK");
+    replay<Lines, LFUReplacement>(trace, "LFU");
+}
+
+void usage(const char *program)
+{
+    std::cerr << "usage: " << program << " FILE\n"
+              << "       " << program << " --zipf N [ALPHA] [--save FILE]\n"
+              << "       " << program << " --scan N [LENGTH] [--save FILE]\n"
+              << "       " << program << " --loop N [SIZE] [--save FILE]\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::string savePath;
+    auto save = std::find(args.begin(), args.end(), "--save");
+    if (save != args.end())
+    {
+        if (save + 1 == args.end())
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        savePath = *(save + 1);
+        args.erase(save, save + 2);
+    }
+    if (args.empty())
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Numbers on the command line and addresses in a text trace are parsed
+    // with stoull() and stod(), which throw on anything that is not a
+    // number or does not fit.
+    Trace trace;
+    const std::string &mode = args[0];
+    try
+    {
+        if (mode == "--zipf" || mode == "--scan" || mode == "--loop")
+        {
+            if (args.size() < 2)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            const std::size_t count = std::stoull(args[1]);
+            if (mode == "--zipf")
+            {
+                trace = zipfTrace(count, args.size() > 2 ? std::stod(args[2]) : 0.99);
+            }
+            else
+            {
+                // A scan length or loop size of 0 makes no sense, and the
+                // generators divide by it
+                const std::size_t span = args.size() > 2 ? std::stoull(args[2]) : (mode == "--scan" ? 1024 : 200);
+                if (span == 0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                trace = mode == "--scan" ? scanTrace(count, span) : loopTrace(count, span);
+            }
+            if (!savePath.empty() && !saveTrace(savePath, trace))
+            {
+                std::cerr << "Unable to write trace to " << savePath << std::endl;
+                return 1;
+            }
+        }
+        else if (!loadTrace(mode, trace))
+        {
+            std::cerr << "Unable to read trace from " << mode << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::invalid_argument &)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    catch (const std::out_of_range &)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::cout << trace.size() << " accesses" << std::endl;
+    std::cout << " lines  policy  hit rate  simulated (s)    wall (s)" << std::endl;
+    replayPolicies<16>(trace);
+    replayPolicies<64>(trace);
+    replayPolicies<256>(trace);
+    return 0;
+}
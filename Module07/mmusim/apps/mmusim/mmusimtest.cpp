@@ -15,6 +15,11 @@
 #include <chrono>
 #include <vector>
 #include <cmath>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
 #include "memmgtunit.hpp"
 
 class MMUSimTest: public ::testing::Test {
@@ -103,4 +108,561 @@ TEST_F(MMUSimTest, NormalTimings) {
     }
     std::pair<double,double> stats = computeStats(timings);
     std::cout << "Mean: " << stats.first << " Std. Dev: " << stats.second << std::endl;
-}
\ No newline at end of file
+    const LatencyHistogram &latency = testUnit.readLatency();
+    auto inMs = [](std::chrono::nanoseconds ns) { return ns.count() / 1e6; };
+    std::cout << "p50: " << inMs(latency.percentile(0.5))
+              << " p99: " << inMs(latency.percentile(0.99))
+              << " p999: " << inMs(latency.percentile(0.999)) << std::endl;
+}
+// Test: Reads of a cached address do not go back to secondary storage
+// Precondition: Value written to the MMU
+// Postcondition: Repeated reads return the value without the storage delay
+TEST_F(MMUSimTest, CacheHit)
+{
+    MemMgtUnit testUnit;
+    testUnit.set(7, 42);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(testUnit[7], 42);
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 100);
+}
+
+// Test: Dirty lines are written back to memory when evicted
+// Precondition: Direct-mapped cache with two lines
+// Postcondition: A value pushed out of the cache can be read back from memory
+TEST_F(MMUSimTest, WriteBackOnEviction)
+{
+    DirectMappedMemMgtUnit<2> testUnit;
+    testUnit.set(0, 10);
+    testUnit.set(2, 20);    // same set as 0, evicts it
+    testUnit.set(4, 40);    // and again, evicts 2
+    EXPECT_EQ(testUnit[0], 10);
+    EXPECT_EQ(testUnit[2], 20);
+}
+
+// Test: Each replacement policy picks the expected victim
+// Precondition: A full four-way set
+// Postcondition: LRU evicts the least recently used line, CLOCK the first
+// line without a second chance, and LFU the least frequently used line
+TEST_F(MMUSimTest, ReplacementPolicies)
+{
+    LRUReplacement::State<4> lru;
+    ClockReplacement::State<4> clock;
+    LFUReplacement::State<4> lfu;
+    for (std::size_t way = 0; way < 4; ++way) {
+        lru.fill(way);
+        clock.fill(way);
+        lfu.fill(way);
+    }
+    lru.touch(0);
+    EXPECT_EQ(lru.victim(), 1u);
+
+    // Everything referenced: the sweep clears all bits and comes back to 0
+    EXPECT_EQ(clock.victim(), 0u);
+    clock.touch(1);
+    EXPECT_EQ(clock.victim(), 2u);
+
+    lfu.touch(0);
+    lfu.touch(1);
+    lfu.touch(3);
+    EXPECT_EQ(lfu.victim(), 2u);
+}
+
+// Test: A set wider than one 64-bit mask word finds and evicts lines
+// Precondition: Fully associative cache with 128 lines
+// Postcondition: All 128 values hit, the next write evicts the LRU line,
+// and that line's value survives the round trip through memory
+TEST_F(MMUSimTest, WideSet)
+{
+    FullyAssociativeMemMgtUnit<128> testUnit;
+    for (std::size_t idx = 0; idx < 128; ++idx) {
+        testUnit.set(idx, 1000 + idx);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t idx = 0; idx < 128; ++idx) {
+        EXPECT_EQ(testUnit[idx], 1000 + static_cast<int>(idx));
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 100);
+
+    testUnit.set(128, 2128);
+    EXPECT_EQ(testUnit[0], 1000);
+    EXPECT_EQ(testUnit[128], 2128);
+}
+
+// Test: Every SIMD tag compare kernel the CPU supports agrees with the
+// scalar version
+// Precondition: Blocks of 1 to 64 random tags with some planted matches
+// Postcondition: All kernels return the same hit mask
+TEST_F(MMUSimTest, TagMatchKernels)
+{
+    std::vector<TagMatchFn> kernels{tagMatcher()};
+#ifdef TAGMATCH_X86
+    kernels.push_back(matchTagsSSE2);
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(matchTagsAVX2);
+    if (__builtin_cpu_supports("avx512f")) kernels.push_back(matchTagsAVX512);
+#endif
+    std::mt19937 gen{415};
+    std::uniform_int_distribution<std::uint32_t> ud(0, 7);
+    std::vector<std::uint32_t> tags(64);
+    for (std::size_t count = 1; count <= 64; ++count) {
+        for (auto &tag : tags) tag = ud(gen);
+        const std::uint64_t expected = matchTagsScalar(tags.data(), count, 3);
+        for (TagMatchFn kernel : kernels) {
+            EXPECT_EQ(kernel(tags.data(), count, 3), expected) << "count " << count;
+        }
+    }
+    // A full 64-way block with every tag matching has no tail at all
+    std::fill(tags.begin(), tags.end(), 3u);
+    for (TagMatchFn kernel : kernels) {
+        EXPECT_EQ(kernel(tags.data(), 64, 3), ~std::uint64_t{0});
+        EXPECT_EQ(kernel(tags.data(), 64, 4), 0u);
+    }
+}
+
+// Test: An asynchronous read delivers the same value as a blocking one
+// Precondition: Value written to memory and pushed out of the cache
+// Postcondition: The future returned by get_async() holds the value, and a
+// bad address yields an already-ready empty optional
+TEST_F(MMUSimTest, AsyncGet)
+{
+    DirectMappedMemMgtUnit<2> testUnit;
+    testUnit.set(0, 10);
+    testUnit.set(2, 20);    // evicts 0
+    std::future<std::optional<int>> pending = testUnit.get_async(0);
+    std::future<std::optional<int>> bad = testUnit.get_async(MEMSIZE + 1);
+    EXPECT_EQ(bad.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    EXPECT_FALSE(bad.get().has_value());
+    EXPECT_EQ(pending.get(), 10);
+}
+
+// Test: Misses in a batch overlap their storage delays
+// Precondition: Eight values in memory, none of them cached
+// Postcondition: get_batch() returns all eight in far less time than
+// eight back to back misses would take
+TEST_F(MMUSimTest, BatchGet)
+{
+    FullyAssociativeMemMgtUnit<16> testUnit;
+    std::vector<std::size_t> indices;
+    for (std::size_t idx = 0; idx < 8; ++idx) {
+        testUnit.set(100 + idx, static_cast<int>(idx));
+        indices.push_back(100 + idx);
+    }
+    // Push the values out to memory by filling the cache with other lines
+    for (std::size_t idx = 0; idx < 16; ++idx) {
+        testUnit.set(idx, 0);
+    }
+    indices.push_back(MEMSIZE + 1);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::optional<int>> values = testUnit.get_batch(indices);
+    auto end = std::chrono::steady_clock::now();
+    ASSERT_EQ(values.size(), indices.size());
+    for (std::size_t idx = 0; idx < 8; ++idx) {
+        EXPECT_EQ(values[idx], static_cast<int>(idx));
+    }
+    EXPECT_FALSE(values.back().has_value());
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 3000);
+}
+
+// Test: The sequential prefetcher loads the next lines ahead of the reader
+// Precondition: A run of values in memory with nothing cached
+// Postcondition: Reading the four lines after the first costs at most
+// about one trip to secondary storage
+TEST_F(MMUSimTest, SequentialPrefetch)
+{
+    FullyAssociativeMemMgtUnit<16> testUnit;
+    testUnit.setPrefetch({PrefetchConfig::Mode::Sequential, 4});
+    testUnit.get(200);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t idx = 201; idx <= 204; ++idx) {
+        testUnit.get(idx);
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 2500);
+}
+
+// Test: The cache stays coherent while 16 threads hammer it
+// Precondition: 128 line, 4-way cache (32 sets).  Pairs of threads share a
+// set and write three addresses each, so they keep evicting each other's
+// dirty lines; everyone also reads a block of values in the other sets.
+// Postcondition: No thread ever reads a wrong value, and after a flush
+// every address holds the last value its owner wrote
+TEST_F(MMUSimTest, ConcurrentStress)
+{
+    using StressUnit = BasicMemMgtUnit<128, 4>;
+    constexpr std::size_t threadCount = 16;
+    constexpr int iterations = 20000;
+    StressUnit testUnit;
+    // Read-only values, one per set in sets 16..31
+    for (std::size_t idx = 16; idx < 32; ++idx) {
+        testUnit.set(idx, static_cast<int>(idx) * 3);
+    }
+    auto owned = [](std::size_t thread, std::size_t k) {
+        return thread / 2 + StressUnit::SETS * (3 * (thread % 2) + k);
+    };
+
+    std::atomic<bool> go{false};
+    std::atomic<int> badReads{0};
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            for (int iter = 0; iter < iterations; ++iter) {
+                for (std::size_t k = 0; k < 3; ++k) {
+                    testUnit.set(owned(t, k), iter * 100 + static_cast<int>(t));
+                }
+                const std::size_t shared = 16 + (iter + t) % 16;
+                if (testUnit.get(shared) != static_cast<int>(shared) * 3) {
+                    badReads++;
+                }
+            }
+        });
+    }
+    go = true;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(badReads.load(), 0);
+
+    testUnit.flush();
+    std::vector<std::size_t> indices;
+    for (std::size_t t = 0; t < threadCount; ++t) {
+        for (std::size_t k = 0; k < 3; ++k) {
+            indices.push_back(owned(t, k));
+        }
+    }
+    std::vector<std::optional<int>> values = testUnit.get_batch(indices);
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+        EXPECT_EQ(values[i], (iterations - 1) * 100 + static_cast<int>(i / 3));
+    }
+}
+
+// Test: The cache counters track hits, misses, evictions and writebacks
+// Precondition: Direct-mapped cache with two lines
+// Postcondition: Counters match the access pattern
+TEST_F(MMUSimTest, CacheCounters)
+{
+    DirectMappedMemMgtUnit<2> testUnit;
+    testUnit.set(0, 10);    // write miss
+    testUnit.set(0, 11);    // write hit
+    testUnit.get(0);        // read hit
+    testUnit.set(2, 20);    // write miss, evicts dirty 0
+    testUnit.get(0);        // read miss, evicts dirty 2
+    CacheCounters counters = testUnit.stats();
+    EXPECT_EQ(counters.hits, 2u);
+    EXPECT_EQ(counters.misses, 3u);
+    EXPECT_EQ(counters.evictions, 2u);
+    EXPECT_EQ(counters.writebacks, 2u);
+    EXPECT_DOUBLE_EQ(counters.hitRate(), 0.4);
+    EXPECT_EQ(testUnit.readLatency().count(), 2u);
+    EXPECT_EQ(testUnit.writeLatency().count(), 3u);
+    // The read miss went to secondary storage, the hit did not
+    EXPECT_GT(testUnit.readLatency().percentile(0.99), testUnit.readLatency().percentile(0.5));
+
+    testUnit.resetStats();
+    EXPECT_EQ(testUnit.stats().hits, 0u);
+    EXPECT_EQ(testUnit.readLatency().count(), 0u);
+}
+
+// Test: Histogram percentiles land close to the exact values
+// Precondition: Latencies of 1..1000 ms recorded
+// Postcondition: p50, p99 and p999 within the 1/16 bucket resolution, and
+// the mean agrees with computeStats()
+TEST_F(MMUSimTest, LatencyPercentiles)
+{
+    LatencyHistogram histogram;
+    std::vector<double> samples;
+    for (int ms = 1; ms <= 1000; ++ms) {
+        histogram.record(std::chrono::milliseconds(ms));
+        samples.push_back(ms);
+    }
+    auto inMs = [](std::chrono::nanoseconds ns) { return ns.count() / 1e6; };
+    EXPECT_NEAR(inMs(histogram.percentile(0.5)), 500, 500 / 16.0);
+    EXPECT_NEAR(inMs(histogram.percentile(0.99)), 990, 990 / 16.0);
+    EXPECT_NEAR(inMs(histogram.percentile(0.999)), 999, 999 / 16.0);
+    EXPECT_NEAR(inMs(histogram.mean()), computeStats(samples).first, 0.01);
+}
+
+// Test: A unit can be destroyed with an asynchronous read still running
+// Precondition: Sequential prefetch on, one get_async() miss in flight
+// Postcondition: The read finishes, queues its prefetch, and the unit is
+// torn down cleanly after both are done
+TEST_F(MMUSimTest, DestroyWithAsyncPending)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        MemMgtUnit testUnit;
+        testUnit.setPrefetch({PrefetchConfig::Mode::Sequential, 1});
+        std::future<std::optional<int>> pending = testUnit.get_async(100);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 10000);
+}
+
+// Test: Asynchronous and batched reads show up in the read latencies
+// Precondition: A unit on a virtual clock holding four written values
+// Postcondition: Every get_async() and get_batch() read, hit or miss, is
+// recorded, and the miss paid the storage delay
+TEST_F(MMUSimTest, AsyncAndBatchLatency)
+{
+    BasicMemMgtUnit<16, 4, LRUReplacement, VirtualClock> testUnit;
+    for (std::size_t idx = 0; idx < 4; ++idx) {
+        testUnit.set(idx, static_cast<int>(idx));
+    }
+    EXPECT_EQ(testUnit.get_async(0).get(), 0);
+    EXPECT_EQ(testUnit.get_async(1).get(), 1);
+    testUnit.get_batch({2, 3, 1000});
+    EXPECT_EQ(testUnit.readLatency().count(), 5u);
+    EXPECT_EQ(testUnit.stats().hits, 4u);
+    if (testUnit.clock().elapsed() > std::chrono::milliseconds(1)) {
+        EXPECT_GT(testUnit.readLatency().percentile(1.0), std::chrono::nanoseconds(std::chrono::milliseconds(1)));
+    }
+}
+
+// Test: The access trace dumps every access in order
+// Precondition: Tracing enabled with room for three records
+// Postcondition: The dump holds the last three accesses with their
+// operation and hit/miss flag; a trace with no room is refused
+TEST_F(MMUSimTest, AccessTrace)
+{
+    MemMgtUnit testUnit;
+    EXPECT_THROW(testUnit.enableTrace(0), std::invalid_argument);
+    testUnit.enableTrace(3);
+    testUnit.set(1, 1);
+    testUnit.set(2, 2);
+    testUnit.get(1);
+    testUnit.set(MEMSIZE + 1, 3);   // bad address, not traced
+    testUnit.get(2);
+    const std::string path = ::testing::TempDir() + "mmutrace.bin";
+    ASSERT_TRUE(testUnit.dumpTrace(path));
+
+    std::ifstream in(path, std::ios::binary);
+    char magic[8];
+    std::uint64_t count = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(&count), sizeof(count));
+    EXPECT_EQ(std::string(magic, 8), "MMUTRACE");
+    ASSERT_EQ(count, 3u);
+    std::vector<TraceRecord> records(count);
+    in.read(reinterpret_cast<char *>(records.data()), count * sizeof(TraceRecord));
+    ASSERT_TRUE(in);
+    EXPECT_EQ(records[0].address, 2u);
+    EXPECT_EQ(records[0].op, TraceRecord::Write);
+    EXPECT_FALSE(records[0].hit);
+    EXPECT_EQ(records[1].address, 1u);
+    EXPECT_EQ(records[1].op, TraceRecord::Read);
+    EXPECT_TRUE(records[1].hit);
+    EXPECT_EQ(records[2].address, 2u);
+    EXPECT_LE(records[1].timestamp, records[2].timestamp);
+}
+
+// Test: Virtual time keeps the storage delay statistics without sleeping
+// Precondition: Direct-mapped single-line cache on a virtual clock
+// Postcondition: 100000 misses finish quickly, and both the simulated time
+// and the latency histogram show the expected 750ms mean delay
+TEST_F(MMUSimTest, VirtualTimings)
+{
+    DirectMappedMemMgtUnit<1, LRUReplacement, VirtualClock> testUnit;
+    testUnit.seed(415);
+    const int accesses = 100000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < accesses; ++i) {
+        testUnit.get(i % 2);
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::seconds>(end - start).count(), 10);
+
+    EXPECT_EQ(testUnit.stats().misses, static_cast<std::uint64_t>(accesses));
+    // Negative draws from the normal distribution count as no delay,
+    // which nudges the mean up a little.
+    const double meanDelay = testUnit.clock().elapsed().count() / static_cast<double>(accesses);
+    EXPECT_NEAR(meanDelay, 750, 10);
+    auto inMs = [](std::chrono::nanoseconds ns) { return ns.count() / 1e6; };
+    EXPECT_NEAR(inMs(testUnit.readLatency().mean()), meanDelay, 1);
+    EXPECT_NEAR(inMs(testUnit.readLatency().percentile(0.5)), 750, 750 / 16.0);
+}
+
+// Test: Seeding the delay generator makes a simulation repeatable
+// Precondition: Two units on virtual clocks with the same seed
+// Postcondition: The same accesses take the same simulated time
+TEST_F(MMUSimTest, SeededDelays)
+{
+    DirectMappedMemMgtUnit<1, LRUReplacement, VirtualClock> first, second;
+    first.seed(2024);
+    second.seed(2024);
+    for (int i = 0; i < 1000; ++i) {
+        first.get(i);
+        second.get(i);
+    }
+    EXPECT_EQ(first.clock().elapsed(), second.clock().elapsed());
+}
+
+// A small paged configuration: 16 int pages, two level page table, four
+// frames and a four entry TLB, so faults and evictions come quickly.
+using SmallPagedStore = PagedStore<4, 2, 4>;
+using PagedUnit = BasicMemMgtUnit<16, 4, LRUReplacement, VirtualClock, SmallPagedStore>;
+
+// Test: Paged memory keeps values across page evictions in an address
+// space far bigger than MEMSIZE
+// Precondition: Paged unit with 2^24 ints of virtual memory and 4 frames
+// Postcondition: Values written to 64 different pages all read back, and
+// the paging counters show the faults, evictions and TLB misses
+TEST_F(MMUSimTest, PagedMemory)
+{
+    SmallPagedStore::Config config;
+    config.size = std::uint64_t{1} << 24;
+    config.frames = 4;
+    PagedUnit testUnit(config);
+    EXPECT_GT(testUnit.size(), static_cast<std::uint64_t>(MEMSIZE));
+    EXPECT_FALSE(testUnit.get(config.size).has_value());
+
+    auto address = [](std::size_t page) { return page * 4099 * 16 + page % 16; };
+    for (std::size_t page = 0; page < 64; ++page) {
+        testUnit.set(address(page), static_cast<int>(page) + 1);
+    }
+    testUnit.flush();
+    for (std::size_t page = 0; page < 64; ++page) {
+        EXPECT_EQ(testUnit.get(address(page)), static_cast<int>(page) + 1);
+    }
+
+    PagingCounters paging = testUnit.store().stats();
+    EXPECT_GE(paging.pageFaults, 64u);
+    EXPECT_GE(paging.pageEvictions, 60u);
+    EXPECT_GE(paging.pageWritebacks, 60u);
+    EXPECT_GT(paging.tlbMisses, 0u);
+    EXPECT_EQ(paging.walkSteps, 2 * paging.tlbMisses);
+}
+
+// Test: Only page faults pay the trip to secondary storage
+// Precondition: Paged unit on a virtual clock
+// Postcondition: A cache miss on a resident page costs no simulated time
+// and hits in the TLB
+TEST_F(MMUSimTest, PageFaultCost)
+{
+    PagedUnit testUnit;
+    testUnit.get(32);
+    const auto afterFault = testUnit.clock().elapsed();
+    EXPECT_EQ(testUnit.store().stats().pageFaults, 1u);
+    testUnit.get(33);   // same page, different cache line
+    EXPECT_EQ(testUnit.stats().misses, 2u);
+    EXPECT_EQ(testUnit.clock().elapsed(), afterFault);
+    EXPECT_EQ(testUnit.store().stats().pageFaults, 1u);
+    EXPECT_EQ(testUnit.store().stats().tlbHits, 1u);
+}
+
+// Test: A page fault costs the same wherever it happens
+// Precondition: Paged unit on a virtual clock with four frames
+// Postcondition: Writes alone never fetch anything, but writing dirty lines
+// back to pages that are not resident faults them in, and those faults
+// advance the clock and show up in the write latencies
+TEST_F(MMUSimTest, WriteBackFaultCost)
+{
+    SmallPagedStore::Config config;
+    config.frames = 4;
+    PagedUnit testUnit(config);
+    testUnit.seed(415);
+    for (std::size_t page = 0; page < 64; ++page) {
+        testUnit.set(page * 16, static_cast<int>(page));
+    }
+    testUnit.flush();
+    EXPECT_GE(testUnit.store().stats().pageFaults, 64u);
+    EXPECT_GT(testUnit.clock().elapsed().count(), 0);
+    EXPECT_GT(testUnit.writeLatency().percentile(1.0), std::chrono::nanoseconds(std::chrono::milliseconds(1)));
+}
+
+// Test: Pages are loaded from and saved to the backing file
+// Precondition: A paged unit with a named backing file
+// Postcondition: A second unit on the same file sees the first one's data
+TEST_F(MMUSimTest, PagedBackingFile)
+{
+    SmallPagedStore::Config config;
+    config.backingFile = ::testing::TempDir() + "mmupages.bin";
+    std::remove(config.backingFile.c_str());
+    {
+        PagedUnit writer(config);
+        writer.set(12345, 678);
+        writer.set(1 << 20, 9);
+        writer.flush();
+    }
+    PagedUnit reader(config);
+    EXPECT_EQ(reader.get(12345), 678);
+    EXPECT_EQ(reader.get(1 << 20), 9);
+    EXPECT_EQ(reader.get(12346), 0);
+    std::remove(config.backingFile.c_str());
+}
+
+// Test: A memory-mapped backing file is big, cheap to open, and persistent
+// Precondition: A 4 GiB sparse backing file
+// Postcondition: Values written near both ends survive reopening the file,
+// and untouched memory reads as zero
+TEST_F(MMUSimTest, MappedBackingFile)
+{
+    using MappedUnit = BasicMemMgtUnit<16, 4, LRUReplacement, VirtualClock, MappedFileStore>;
+    MappedFileStore::Config config;
+    config.path = ::testing::TempDir() + "mmumapped.bin";
+    config.size = std::uint64_t{1} << 30;
+    std::remove(config.path.c_str());
+    const std::size_t far = (std::size_t{1} << 30) - 1;
+    {
+        MappedUnit writer(config);
+        EXPECT_EQ(writer.size(), config.size);
+        writer.set(5, 55);
+        writer.set(far, 77);
+        writer.flush();
+        writer.store().sync();
+    }
+    auto start = std::chrono::steady_clock::now();
+    MappedUnit reader(config);
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count(), 100);
+    EXPECT_EQ(reader.get(5), 55);
+    EXPECT_EQ(reader.get(far), 77);
+    EXPECT_EQ(reader.get(far / 2), 0);
+    EXPECT_FALSE(reader.get(far + 1).has_value());
+    std::remove(config.path.c_str());
+}
+
+// Test: Dirty lines reach a persistent store when the unit goes away
+// Precondition: Paged and mapped units with named backing files, written
+// to but never flushed
+// Postcondition: Units reopened on the same files see the writes
+TEST_F(MMUSimTest, WriteBackOnDestruction)
+{
+    SmallPagedStore::Config paged;
+    paged.backingFile = ::testing::TempDir() + "mmupages-unflushed.bin";
+    std::remove(paged.backingFile.c_str());
+    {
+        PagedUnit writer(paged);
+        writer.set(4321, 12);
+        writer.set(1 << 20, 34);
+    }
+    {
+        PagedUnit reader(paged);
+        EXPECT_EQ(reader.get(4321), 12);
+        EXPECT_EQ(reader.get(1 << 20), 34);
+    }
+    std::remove(paged.backingFile.c_str());
+
+    using MappedUnit = BasicMemMgtUnit<16, 4, LRUReplacement, VirtualClock, MappedFileStore>;
+    MappedFileStore::Config mapped;
+    mapped.path = ::testing::TempDir() + "mmumapped-unflushed.bin";
+    mapped.size = std::uint64_t{1} << 20;
+    std::remove(mapped.path.c_str());
+    {
+        MappedUnit writer(mapped);
+        writer.set(7, 56);
+        writer.set(mapped.size - 1, 78);
+    }
+    {
+        MappedUnit reader(mapped);
+        EXPECT_EQ(reader.get(7), 56);
+        EXPECT_EQ(reader.get(mapped.size - 1), 78);
+    }
+    std::remove(mapped.path.c_str());
+}
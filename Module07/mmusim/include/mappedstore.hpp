@@ -0,0 +1,119 @@
+//
+// File:    mappedstore.hpp
+// Author:  Your Glorious Instructor
+// Purpose:
+// Backing store for the MMU that maps a file into memory with mmap(), the
+// same technique as Module05/shm/mmapdemo.c.  The simulated memory can then
+// be gigabytes in size and outlive the process: opening a store is O(1) no
+// matter how big the file is, since the kernel only reads a page in the
+// first time it is touched, and the file is grown with ftruncate() so the
+// parts that are never written take no disk space.
+//
+// Like FlatStore, every read into the cache still makes the simulated trip
+// to secondary storage.  With no file name the store is anonymous memory
+// that goes away with the process.
+//
+#ifndef MAPPEDSTORE_HPP
+#define MAPPEDSTORE_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFileStore
+{
+public:
+    struct Config
+    {
+        std::string path;
+        std::uint64_t size = std::uint64_t{1} << 28;    // ints, 1 GiB
+    };
+    static constexpr std::uint64_t MAX_SIZE = std::uint64_t{1} << 32;
+
+    MappedFileStore(const MappedFileStore&) = delete;
+    MappedFileStore& operator=(const MappedFileStore&) = delete;
+
+    MappedFileStore() : MappedFileStore(Config{}) {}
+
+    explicit MappedFileStore(const Config &config) : words(config.size)
+    {
+        if (words == 0 || words > MAX_SIZE)
+        {
+            throw std::invalid_argument("MappedFileStore: bad size");
+        }
+        const std::size_t bytes = words * sizeof(int);
+        int flags = MAP_SHARED;
+        if (config.path.empty())
+        {
+            flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+        }
+        else
+        {
+            if ((fd = ::open(config.path.c_str(), O_RDWR | O_CREAT, 0644)) == -1)
+            {
+                throw std::runtime_error("MappedFileStore: unable to open " + config.path);
+            }
+            struct stat info;
+            if (::fstat(fd, &info) == -1 ||
+                (static_cast<std::uint64_t>(info.st_size) < bytes && ::ftruncate(fd, bytes) == -1))
+            {
+                ::close(fd);
+                throw std::runtime_error("MappedFileStore: unable to size " + config.path);
+            }
+        }
+        void *mapped = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            if (fd != -1)
+            {
+                ::close(fd);
+            }
+            throw std::runtime_error("MappedFileStore: mmap failed");
+        }
+        memory = static_cast<int *>(mapped);
+    }
+
+    ~MappedFileStore()
+    {
+        ::munmap(memory, words * sizeof(int));
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+    }
+
+    std::uint64_t size() const { return words; }
+
+    template <typename Delay>
+    void fetch(std::size_t, Delay delay) { delay(); }
+
+    template <typename Delay>
+    int read(std::size_t address, Delay) { return memory[address]; }
+    template <typename Delay>
+    void write(std::size_t address, int value, Delay) { memory[address] = value; }
+
+    //
+    // void sync()
+    // Wait for every modified page to reach the file.  munmap() gets them
+    // there eventually anyway; this is for when "eventually" is not enough.
+    //
+    void sync()
+    {
+        if (fd != -1)
+        {
+            ::msync(memory, words * sizeof(int), MS_SYNC);
+        }
+    }
+
+private:
+    std::uint64_t words;
+    int fd = -1;
+    int *memory = nullptr;
+};
+
+#endif
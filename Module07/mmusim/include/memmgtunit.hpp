@@ -7,94 +7,861 @@
 // the amount of time required to access that memory has a delay that emulates
 // have to go out to secondary storage to get the data.
 // 
-// This is the starter code for a CS415 assignment where you will need 
-// to implement a caching scheme to speed up access to the "memory".  The 
-// cache is simulated (well, be simulated by you) using an array of 16 "cache" 
-// lines.  Each line will be a C++ tuple containing the following:
-// (address, value, invalid flag, dirty flag).
+// Accesses to "memory" go through a write-back cache that sits in front of
+// the slow store.  The cache geometry and the replacement policy are chosen
+// with template parameters:
+//   Lines       - total number of cache lines
+//   Ways        - lines per set; 1 gives a direct-mapped cache and
+//                 Ways == Lines gives a fully associative cache
+//   Replacement - which line of a full set gets flushed on a miss
+//                 (LRUReplacement, ClockReplacement, or LFUReplacement)
+//   Clock       - how the storage delay is served: RealTimeClock sleeps,
+//                 VirtualClock just keeps count (see simclock.hpp)
+//   Store       - what sits behind the cache: FlatStore is the original
+//                 flat array where every miss goes to secondary storage,
+//                 PagedStore is paged virtual memory where only page
+//                 faults do (see pagedstore.hpp), and MappedFileStore is
+//                 a memory-mapped file that persists between runs (see
+//                 mappedstore.hpp)
+//
+// The lines are stored as a structure of arrays: one packed array of tags,
+// one of values, and a valid and a dirty bitmask per set.  Looking up an
+// address is then a single contiguous scan over the tags of its set, done
+// with the widest SIMD compare the CPU supports (see tagmatch.hpp).
 // 
-// You will need to adjust this code to cache the most recently accessed 
-// items from "memory".   You will need to adjust the code to hit the
-// cache first, bring in a new item if there is a cache miss, and decide 
-// which line gets flushed if the cache is full.   Note that you will need 
-// to make certain your cache remains "coherent": updates to the value in the
-// cache get flushed to memory and a line stays in sync with the value in 
-// memory.
+// A read hits the cache first and only pays the secondary storage delay on a
+// miss.  A write updates the line in the cache and marks it dirty; the value
+// makes it back to memory when the line is evicted or when flush() is called,
+// so the cache and memory stay coherent.
+//
+// Reads that would block on secondary storage can also be issued without
+// waiting: get_async() returns a future for a single read, and get_batch()
+// hands every miss in a batch to a pool of worker threads so their delays
+// overlap.  An optional sequential or stride prefetcher watches the reads
+// coming through get() and starts loading the lines it expects to be asked
+// for next.
+//
+// The unit is safe to share between threads.  Rather than one big lock,
+// each cache set has its own mutex: an address only ever lives in its own
+// set, and memory behind a set is only written back by that set, so
+// threads working on different sets never wait on each other.  The trip to
+// secondary storage for a read miss is served with no lock held.
+// Concurrency therefore scales with the number of sets; a fully
+// associative cache has one set and serializes.
+//
+// The exception is a store with residency, such as PagedStore.  Writing a
+// dirty victim back to a page that is not resident, or reading in a line
+// whose page was evicted again after fetch() loaded it, faults the page in
+// from inside allocate() or fill(), with the set's lock held.  The storage
+// delay is then served under that lock, and every other thread that wants
+// the same set waits for it too.
+//
+// Every unit keeps hit/miss/eviction/writeback counters and latency
+// histograms for reads (through get(), get_async() or get_batch()) and
+// for set() (see mmustats.hpp); hits and misses count both reads and
+// writes.  enableTrace() additionally records each access
+// in a ring buffer that dumpTrace() writes out to a binary file.
+//
+#ifndef MEMMGTUNIT_HPP
+#define MEMMGTUNIT_HPP
 
 #include <iostream>
-#include <tuple>
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <random>
 #include <cmath>
+#include <future>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mappedstore.hpp"
+#include "mmustats.hpp"
+#include "pagedstore.hpp"
+#include "simclock.hpp"
+#include "tagmatch.hpp"
+#include "workerpool.hpp"
 
 const int MEMSIZE = 65535;
 
-class MemMgtUnit
+//
+// FlatStore
+// The simulated memory as a flat array of MEMSIZE ints.  There is no
+// notion of residency, so every read into the cache makes the trip to
+// secondary storage.
+//
+// A store provides size(), read(address, delay), write(address, value,
+// delay), and fetch(address, delay), which the cache calls without holding
+// any of its locks before reading an address in.  Each of them calls
+// delay() whenever it has to go out to secondary storage.  After a fetch()
+// a read() normally does not, but a write-back to somewhere else, or a
+// read whose address was pushed out again in the meantime, can.  sync()
+// makes everything written so far durable, for stores that outlive the
+// unit.
+//
+class FlatStore
+{
+public:
+    struct Config {};
+    static constexpr std::uint64_t MAX_SIZE = MEMSIZE;
+
+    FlatStore() = default;
+    explicit FlatStore(const Config &) {}
+
+    std::uint64_t size() const { return MEMSIZE; }
+
+    template <typename Delay>
+    void fetch(std::size_t, Delay delay) { delay(); }
+
+    template <typename Delay>
+    int read(std::size_t address, Delay) { return memory[address]; }
+    template <typename Delay>
+    void write(std::size_t address, int value, Delay) { memory[address] = value; }
+    void sync() {}
+
+private:
+    std::unique_ptr<int[]> memory{new int[MEMSIZE]};
+};
+const std::size_t MMU_WORKERS = 16;
+
+//
+// PrefetchConfig
+// Controls the prefetcher.  Sequential prefetches the next `degree`
+// addresses after every read.  Stride waits until two consecutive reads
+// are the same distance apart and then prefetches `degree` further steps
+// along that stride.
+//
+struct PrefetchConfig
+{
+    enum class Mode { None, Sequential, Stride };
+    Mode mode = Mode::None;
+    std::size_t degree = 1;
+};
+
+//
+// Replacement policies
+// Each policy provides a State<Ways> class that tracks a single cache set.
+// The cache calls touch() when a line in the set is hit, fill() when a line
+// is (re)loaded, and victim() to pick the line to evict when every line in
+// the set is valid.
+//
+
+//
+// LRUReplacement
+// Evict the line that has gone the longest without being used.
+//
+struct LRUReplacement
+{
+    template <std::size_t Ways>
+    class State
+    {
+    private:
+        std::array<std::uint64_t, Ways> lastUse{};
+        std::uint64_t tick = 0;
+    public:
+        void touch(std::size_t way) { lastUse[way] = ++tick; }
+        void fill(std::size_t way) { touch(way); }
+        std::size_t victim()
+        {
+            std::size_t oldest = 0;
+            for (std::size_t way = 1; way < Ways; ++way)
+            {
+                if (lastUse[way] < lastUse[oldest])
+                {
+                    oldest = way;
+                }
+            }
+            return oldest;
+        }
+    };
+};
+
+//
+// ClockReplacement
+// Second-chance approximation of LRU.  Each line has a reference bit that
+// is set on use; the clock hand sweeps the set clearing bits until it finds
+// a line that has not been referenced since the last sweep.
+//
+struct ClockReplacement
 {
+    template <std::size_t Ways>
+    class State
+    {
+    private:
+        std::array<bool, Ways> referenced{};
+        std::size_t hand = 0;
+    public:
+        void touch(std::size_t way) { referenced[way] = true; }
+        void fill(std::size_t way) { referenced[way] = true; }
+        std::size_t victim()
+        {
+            while (referenced[hand])
+            {
+                referenced[hand] = false;
+                hand = (hand + 1) % Ways;
+            }
+            std::size_t way = hand;
+            hand = (hand + 1) % Ways;
+            return way;
+        }
+    };
+};
+
+//
+// LFUReplacement
+// Evict the line with the fewest uses since it was loaded.  Ties go to the
+// lowest numbered way.
+//
+struct LFUReplacement
+{
+    template <std::size_t Ways>
+    class State
+    {
+    private:
+        std::array<std::uint64_t, Ways> uses{};
+    public:
+        void touch(std::size_t way) { ++uses[way]; }
+        void fill(std::size_t way) { uses[way] = 1; }
+        std::size_t victim()
+        {
+            std::size_t least = 0;
+            for (std::size_t way = 1; way < Ways; ++way)
+            {
+                if (uses[way] < uses[least])
+                {
+                    least = way;
+                }
+            }
+            return least;
+        }
+    };
+};
+
+template <std::size_t Lines = 16,
+          std::size_t Ways = 4,
+          typename Replacement = LRUReplacement,
+          typename Clock = RealTimeClock,
+          typename Store = FlatStore>
+class BasicMemMgtUnit
+{
+    static_assert(Lines > 0, "cache needs at least one line");
+    static_assert(Ways > 0 && Lines % Ways == 0,
+                  "cache lines must divide evenly into sets");
+    static_assert((Store::MAX_SIZE - 1) / (Lines / Ways) <= UINT32_MAX,
+                  "cache tags are 32 bits wide");
+public:
+    static constexpr std::size_t SETS = Lines / Ways;
 private:
-    int *memory = new int[MEMSIZE];
-    using CacheLine = std::tuple<std::size_t, int, bool, bool>;
-    std::array<CacheLine, 16> cache;
+    // One bit per way of a set, 64 ways to a word.
+    static constexpr std::size_t MASK_WORDS = (Ways + 63) / 64;
+    using LineMask = std::array<std::uint64_t, MASK_WORDS>;
+
+    Store backing;
+    // Line (set * Ways + way) holds the address (tag * SETS + set).  Tags
+    // are 32 bits wide so a SIMD register holds as many of them as possible.
+    std::array<std::uint32_t, Lines> tags{};
+    std::array<int, Lines> values{};
+    std::array<LineMask, SETS> valid{};
+    std::array<LineMask, SETS> dirty{};
+    std::array<typename Replacement::template State<Ways>, SETS> replacement{};
+
+    static bool testBit(const LineMask &mask, std::size_t way)
+    {
+        return (mask[way / 64] >> (way % 64)) & 1;
+    }
+    static void setBit(LineMask &mask, std::size_t way)
+    {
+        mask[way / 64] |= std::uint64_t{1} << (way % 64);
+    }
+    static void clearBit(LineMask &mask, std::size_t way)
+    {
+        mask[way / 64] &= ~(std::uint64_t{1} << (way % 64));
+    }
+
+    // One lock per set, each on its own hardware cache line so that
+    // threads hammering neighbouring sets do not false-share.  A set's
+    // lock guards its lines, its replacement state, and the memory words
+    // that map to it.
+    struct alignas(64) SetLock
+    {
+        std::mutex mutex;
+    };
+    std::array<SetLock, SETS> setLocks{};
+    std::mutex &lockFor(std::size_t index) { return setLocks[index % SETS].mutex; }
+
+    // Guards the prefetcher state below.  When both are needed, take the
+    // set lock first.
+    std::mutex prefetchMutex;
+    PrefetchConfig prefetch;
+    std::size_t lastRead = 0;
+    long long lastStride = 0;
+    // Prefetches that are waiting on secondary storage, by address.
+    std::unordered_map<std::size_t, std::shared_future<void>> prefetching;
+
+    Clock storageClock;
+    CacheStats counters;
+    LatencyHistogram reads;
+    LatencyHistogram writes;
+    const std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+    std::unique_ptr<AccessTrace> trace;
+
+    // Storage delays are drawn from one generator per unit, seeded once.
+    std::mutex delayMutex;
+    std::mt19937 delayGen{std::random_device{}()};
+    std::normal_distribution<double> delayDist{750, 300};
+
+    // Started the first time something is handed off to a worker.  Declared
+    // last so the workers are joined before the rest of the unit goes away.
+    std::size_t workerCount = MMU_WORKERS;
+    std::once_flag workersStarted;
+    std::unique_ptr<WorkerPool> pool;
+
+    void writeBack(std::size_t set, std::size_t way, std::chrono::milliseconds &delay);
     int determineDelay();
+    std::chrono::milliseconds storageDelay();
+
+    // What a read through the cache found and how long it spent waiting
+    // on secondary storage.
+    struct ReadResult
+    {
+        int value;
+        bool hit;
+        std::chrono::milliseconds delay;
+    };
+    std::optional<std::size_t> lookup(std::size_t index);
+    std::size_t allocate(std::size_t index, std::chrono::milliseconds &delay);
+    std::optional<int> cached(std::size_t index);
+    int fill(std::size_t index, std::chrono::milliseconds &delay);
+    ReadResult readThrough(std::size_t index);
+    std::chrono::nanoseconds latencySince(std::chrono::steady_clock::time_point start,
+                                          std::chrono::milliseconds delay) const;
+    void prefetchAfter(std::size_t index);
+    void traceAccess(std::size_t index, TraceRecord::Op op, bool hit);
+    WorkerPool &workers();
 public:
+    BasicMemMgtUnit() = default;
+    explicit BasicMemMgtUnit(std::size_t workerThreads) : workerCount(workerThreads) {}
+    explicit BasicMemMgtUnit(const typename Store::Config &config,
+                             std::size_t workerThreads = MMU_WORKERS)
+        : backing(config), workerCount(workerThreads) {}
+    ~BasicMemMgtUnit();
 
     std::optional<int> get(std::size_t index);
+    std::future<std::optional<int>> get_async(std::size_t index);
+    std::vector<std::optional<int>> get_batch(const std::vector<std::size_t> &indices);
     void set(std::size_t index, int value);
     int operator[](std::size_t index);
+    void flush();
+    void setPrefetch(PrefetchConfig config);
+    void seed(std::uint32_t value);
+    const Clock &clock() const { return storageClock; }
+    Store &store() { return backing; }
+    std::uint64_t size() const { return backing.size(); }
+
+    CacheCounters stats() const { return counters.snapshot(); }
+    const LatencyHistogram &readLatency() const { return reads; }
+    const LatencyHistogram &writeLatency() const { return writes; }
+    void resetStats();
+    void enableTrace(std::size_t records);
+    bool dumpTrace(const std::string &path) const;
 };
 
+//
+// Convenience names for the common cache organizations.  MemMgtUnit is
+// the 16 line cache the simulation has always used, arranged as 4 sets
+// of 4 lines.
+//
+template <std::size_t Lines,
+          typename Replacement = LRUReplacement,
+          typename Clock = RealTimeClock,
+          typename Store = FlatStore>
+using DirectMappedMemMgtUnit = BasicMemMgtUnit<Lines, 1, Replacement, Clock, Store>;
+
+template <std::size_t Lines,
+          typename Replacement = LRUReplacement,
+          typename Clock = RealTimeClock,
+          typename Store = FlatStore>
+using FullyAssociativeMemMgtUnit = BasicMemMgtUnit<Lines, Lines, Replacement, Clock, Store>;
+
+using MemMgtUnit = BasicMemMgtUnit<>;
+
+//
+// ~MemMgtUnit()
+// Let the workers finish whatever is queued, then write every dirty line
+// back and sync the store, so that a persistent store keeps what was
+// written even if nobody called flush().  The pool is shut down in place
+// rather than destroyed, since a job that is still running may want to
+// queue a prefetch through workers() on its way out.  A destructor must
+// not throw, so a store that cannot write back has its error reported
+// instead.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::~BasicMemMgtUnit()
+{
+    if (pool)
+    {
+        pool->shutdown();
+    }
+    try
+    {
+        flush();
+        backing.sync();
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << "MemMgtUnit: unable to write back on shutdown: " << error.what() << "\n";
+    }
+}
+
 //
 // int determineDelay()
 // Use the normal distribution support in the STL random library to
 // give us an idea of the amount of delay it takes to read something from 
 // our simulated offline storage.   This is normally distributed with a mean of 
-// 750ms and std. deviation of 300ms. 
+// 750ms and std. deviation of 300ms.  The generator belongs to the unit and
+// is only seeded once; building a fresh random_device and mt19937 on every
+// miss used to cost more than the rest of the simulation put together.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+int BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::determineDelay()
+{
+    std::lock_guard<std::mutex> lock(delayMutex);
+    return std::round(delayDist(delayGen));
+}
+
+//
+// std::chrono::milliseconds storageDelay()
+// Delay for random amount of time to simulate time required to get to
+// secondary storage.  The clock decides whether that means sleeping or
+// just moving simulated time forward.  Returns the delay served; the
+// normal distribution has a tail below zero, which counts as no delay.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::chrono::milliseconds BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::storageDelay()
+{
+    const std::chrono::milliseconds delayTime(std::max(0, determineDelay()));
+    storageClock.wait(delayTime);
+    return delayTime;
+}
+
+//
+// std::chrono::nanoseconds latencySince(time_point, std::chrono::milliseconds)
+// Latency of an operation that started at start and spent delay waiting
+// on secondary storage.  With a clock that sleeps the delay is already in
+// the elapsed wall time; with a virtual clock it has to be added on.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::chrono::nanoseconds
+BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::latencySince(std::chrono::steady_clock::time_point start,
+                                                                      std::chrono::milliseconds delay) const
+{
+    std::chrono::nanoseconds latency = std::chrono::steady_clock::now() - start;
+    if (!Clock::SLEEPS)
+    {
+        latency += delay;
+    }
+    return latency;
+}
+
+//
+// std::optional<std::size_t> lookup(std::size_t)
+// Search the set that index maps to for a valid line holding index.
+// Returns the position of that line in the cache, or std::nullopt on a miss.
+// Each 64-way block of tags goes through the SIMD tag matcher; the valid
+// mask then filters out empty lines.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::optional<std::size_t>
+BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::lookup(std::size_t index)
+{
+    const std::size_t set = index % SETS;
+    const std::uint32_t tag = static_cast<std::uint32_t>(index / SETS);
+    const std::uint32_t *setTags = &tags[set * Ways];
+    const TagMatchFn matchTags = tagMatcher();
+    for (std::size_t word = 0; word < MASK_WORDS; ++word)
+    {
+        const std::size_t first = word * 64;
+        const std::size_t count = std::min<std::size_t>(64, Ways - first);
+        std::uint64_t match = matchTags(setTags + first, count, tag);
+        match &= valid[set][word];
+        if (match != 0)
+        {
+            return set * Ways + first + __builtin_ctzll(match);
+        }
+    }
+    return std::nullopt;
+}
+
+//
+// void writeBack(std::size_t, std::size_t, std::chrono::milliseconds &)
+// Copy a dirty line back to memory and mark it clean.  If that means a
+// trip to secondary storage, its delay is added to delay.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::writeBack(std::size_t set, std::size_t way,
+                                                                        std::chrono::milliseconds &delay)
+{
+    if (testBit(valid[set], way) && testBit(dirty[set], way))
+    {
+        const std::size_t slot = set * Ways + way;
+        backing.write(static_cast<std::size_t>(tags[slot]) * SETS + set, values[slot],
+                      [&] { delay += storageDelay(); });
+        clearBit(dirty[set], way);
+        CacheStats::bump(counters.writebacks);
+    }
+}
+
+//
+// std::size_t allocate(std::size_t, std::chrono::milliseconds &)
+// Find a line in index's set to hold index, preferring an invalid line and
+// otherwise asking the replacement policy for a victim.  A dirty victim is
+// written back to memory before the line is handed out.  The returned line
+// is tagged with index but left invalid; the caller fills it in.  Any
+// storage delay the write-back costs is added to delay.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::size_t BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::allocate(std::size_t index,
+                                                                              std::chrono::milliseconds &delay)
+{
+    const std::size_t set = index % SETS;
+    std::size_t way = Ways;
+    for (std::size_t word = 0; word < MASK_WORDS; ++word)
+    {
+        std::uint64_t free = ~valid[set][word];
+        if (free != 0)
+        {
+            way = std::min(Ways, word * 64 + __builtin_ctzll(free));
+            break;
+        }
+    }
+    if (way == Ways)
+    {
+        way = replacement[set].victim();
+        writeBack(set, way, delay);
+        CacheStats::bump(counters.evictions);
+    }
+
+    clearBit(valid[set], way);
+    clearBit(dirty[set], way);
+    tags[set * Ways + way] = static_cast<std::uint32_t>(index / SETS);
+    replacement[set].fill(way);
+    return set * Ways + way;
+}
+
+//
+// std::optional<int> cached(std::size_t)
+// Return the value for index if it is in the cache, updating the
+// replacement state.  The caller must hold the lock for index's set.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::optional<int> BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::cached(std::size_t index)
+{
+    if (std::optional<std::size_t> hit = lookup(index))
+    {
+        replacement[index % SETS].touch(*hit % Ways);
+        return values[*hit];
+    }
+    return std::nullopt;
+}
+
+//
+// int fill(std::size_t, std::chrono::milliseconds &)
+// Bring index into the cache once its trip to secondary storage is over.
+// Somebody else may have loaded or written the line while we waited, in
+// which case their copy wins.  Writing back the line we replace, or
+// reading an address that left the store again since it was fetched, can
+// cost another trip; that delay is added to delay.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+int BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::fill(std::size_t index,
+                                                                   std::chrono::milliseconds &delay)
+{
+    std::lock_guard<std::mutex> lock(lockFor(index));
+    if (std::optional<int> value = cached(index))
+    {
+        return *value;
+    }
+    std::size_t slot = allocate(index, delay);
+    values[slot] = backing.read(index, [&] { delay += storageDelay(); });
+    setBit(valid[index % SETS], slot % Ways);
+    return values[slot];
+}
+
+//
+// ReadResult readThrough(std::size_t)
+// Read a valid address through the cache.  On a miss we either wait for a
+// prefetch of the address that is already under way or go to secondary
+// storage ourselves.
 //
-int MemMgtUnit::determineDelay()
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+typename BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::ReadResult
+BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::readThrough(std::size_t index)
 {
-    const double mean = 750;
-    const double stddev = 300;
-    std::random_device rd{};
-    std::mt19937 gen{rd()};
-    std::normal_distribution nd(mean, stddev);
-    // Use nd to get normally distributed number, multiply by 100,
-    // and then round to get integer;
-    return std::round(nd(gen));
+    std::shared_future<void> pending;
+    {
+        std::lock_guard<std::mutex> lock(lockFor(index));
+        if (std::optional<int> value = cached(index))
+        {
+            CacheStats::bump(counters.hits);
+            return {*value, true, std::chrono::milliseconds(0)};
+        }
+        CacheStats::bump(counters.misses);
+        std::lock_guard<std::mutex> prefetchLock(prefetchMutex);
+        auto inFlight = prefetching.find(index);
+        if (inFlight != prefetching.end())
+        {
+            pending = inFlight->second;
+        }
+    }
+    if (pending.valid())
+    {
+        pending.wait();
+        std::lock_guard<std::mutex> lock(lockFor(index));
+        if (std::optional<int> value = cached(index))
+        {
+            return {*value, false, std::chrono::milliseconds(0)};
+        }
+    }
+    std::chrono::milliseconds delay(0);
+    backing.fetch(index, [&] { delay += storageDelay(); });
+    const int value = fill(index, delay);
+    return {value, false, delay};
+}
+
+//
+// void prefetchAfter(std::size_t)
+// Given that index was just read, start loading whatever the prefetcher
+// thinks comes next.  Addresses that are already cached or already being
+// prefetched are skipped.  A prefetch only shows up in `prefetching` once a
+// worker has picked it up, so a reader never waits on a job that is still
+// stuck in the queue behind it.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::prefetchAfter(std::size_t index)
+{
+    std::vector<std::size_t> candidates;
+    std::vector<std::size_t> wanted;
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        const long long stride = static_cast<long long>(index) - static_cast<long long>(lastRead);
+        long long step = 0;
+        if (prefetch.mode == PrefetchConfig::Mode::Sequential)
+        {
+            step = 1;
+        }
+        else if (prefetch.mode == PrefetchConfig::Mode::Stride && stride != 0 && stride == lastStride)
+        {
+            step = stride;
+        }
+        lastRead = index;
+        lastStride = stride;
+
+        for (std::size_t ahead = 1; step != 0 && ahead <= prefetch.degree; ++ahead)
+        {
+            const long long target = static_cast<long long>(index) + step * static_cast<long long>(ahead);
+            if (target < 0 || static_cast<std::uint64_t>(target) >= backing.size())
+            {
+                break;
+            }
+            candidates.push_back(target);
+        }
+    }
+    for (std::size_t target : candidates)
+    {
+        std::lock_guard<std::mutex> lock(lockFor(target));
+        std::lock_guard<std::mutex> prefetchLock(prefetchMutex);
+        if (!lookup(target).has_value() && prefetching.count(target) == 0)
+        {
+            wanted.push_back(target);
+        }
+    }
+
+    for (std::size_t target : wanted)
+    {
+        workers().submit([this, target] {
+            std::promise<void> done;
+            {
+                std::lock_guard<std::mutex> lock(lockFor(target));
+                std::lock_guard<std::mutex> prefetchLock(prefetchMutex);
+                if (lookup(target).has_value() || prefetching.count(target) != 0)
+                {
+                    return;
+                }
+                prefetching.emplace(target, done.get_future().share());
+            }
+            std::chrono::milliseconds delay(0);
+            backing.fetch(target, [&] { delay += storageDelay(); });
+            fill(target, delay);
+            {
+                std::lock_guard<std::mutex> lock(prefetchMutex);
+                prefetching.erase(target);
+            }
+            done.set_value();
+        });
+    }
+}
+
+//
+// WorkerPool &workers()
+// The pool of threads that serve asynchronous reads and prefetches.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+WorkerPool &BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::workers()
+{
+    std::call_once(workersStarted, [this] {
+        pool = std::make_unique<WorkerPool>(workerCount);
+    });
+    return *pool;
 }
 
 //
 // std::optional<int> MemMgtUnit::get(std::size_t)
 // Get a value from the store, in the form of a C++ optional value, with
 // the value at the index if things worked or the std::nullopt if 
-// there was an error.
+// there was an error.  Only a cache miss pays for the trip to
+// secondary storage.
 //
-std::optional<int> MemMgtUnit::get(std::size_t index) 
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::optional<int> BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::get(std::size_t index)
 {
     std::optional<int> value = std::nullopt;
-    if ((index >= 0) && (index < MEMSIZE))
+    if ((index >= 0) && (index < backing.size()))
     {
-        // Delay for random amount of time to simulate time
-        // required to get to secondary storage.
-        int delayTime = determineDelay();
-        std::this_thread::sleep_for(std::chrono::milliseconds(delayTime));
-        value = memory[index];
+        const auto start = std::chrono::steady_clock::now();
+        const ReadResult read = readThrough(index);
+        reads.record(latencySince(start, read.delay));
+        traceAccess(index, TraceRecord::Read, read.hit);
+        value = read.value;
+        prefetchAfter(index);
     }
     return value;
 }
+
+//
+// std::future<std::optional<int>> MemMgtUnit::get_async(std::size_t)
+// Start a read and return right away.  Hits and bad addresses come back
+// as an already-satisfied future; misses are served by a worker thread.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::future<std::optional<int>>
+BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::get_async(std::size_t index)
+{
+    std::optional<int> value = std::nullopt;
+    if ((index >= 0) && (index < backing.size()))
+    {
+        const auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(lockFor(index));
+            value = cached(index);
+        }
+        if (value.has_value())
+        {
+            CacheStats::bump(counters.hits);
+            reads.record(latencySince(start, std::chrono::milliseconds(0)));
+            traceAccess(index, TraceRecord::Read, true);
+        }
+        else
+        {
+            return workers().submit([this, index]() -> std::optional<int> {
+                return get(index);
+            });
+        }
+        prefetchAfter(index);
+    }
+    std::promise<std::optional<int>> ready;
+    ready.set_value(value);
+    return ready.get_future();
+}
+
+//
+// std::vector<std::optional<int>> MemMgtUnit::get_batch(const std::vector<std::size_t> &)
+// Read a whole batch of addresses.  Every miss is handed to a worker at
+// once, so a batch costs about one trip to secondary storage rather than
+// one per miss.  Batches do not train the prefetcher.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+std::vector<std::optional<int>>
+BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::get_batch(const std::vector<std::size_t> &indices)
+{
+    std::vector<std::optional<int>> results(indices.size());
+    std::vector<std::future<int>> misses(indices.size());
+    for (std::size_t i = 0; i < indices.size(); ++i)
+    {
+        const std::size_t index = indices[i];
+        if ((index >= 0) && (index < backing.size()))
+        {
+            const auto start = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(lockFor(index));
+                results[i] = cached(index);
+            }
+            if (results[i].has_value())
+            {
+                CacheStats::bump(counters.hits);
+                reads.record(latencySince(start, std::chrono::milliseconds(0)));
+                traceAccess(index, TraceRecord::Read, true);
+            }
+            else
+            {
+                misses[i] = workers().submit([this, index, start] {
+                    const ReadResult read = readThrough(index);
+                    reads.record(latencySince(start, read.delay));
+                    traceAccess(index, TraceRecord::Read, read.hit);
+                    return read.value;
+                });
+            }
+        }
+    }
+    for (std::size_t i = 0; i < indices.size(); ++i)
+    {
+        if (misses[i].valid())
+        {
+            results[i] = misses[i].get();
+        }
+    }
+    return results;
+}
+
 //
 // void MemMgtUnit::set(std::size_t, int)
 // Set a value in the store, displaying an error if an 
-// invalid address is passed to us.
+// invalid address is passed to us.  The write lands in the cache and
+// is marked dirty; memory is updated when the line is written back.
 //
-void MemMgtUnit::set(std::size_t index, int value)
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::set(std::size_t index, int value)
 {
-    if ((index >= 0) && (index < MEMSIZE))
+    if ((index >= 0) && (index < backing.size()))
     {
-        memory[index] = value;
+        const auto start = std::chrono::steady_clock::now();
+        std::chrono::milliseconds delay(0);
+        bool hit;
+        {
+            std::lock_guard<std::mutex> lock(lockFor(index));
+            std::optional<std::size_t> slot = lookup(index);
+            hit = slot.has_value();
+            if (hit)
+            {
+                replacement[index % SETS].touch(*slot % Ways);
+            }
+            else
+            {
+                // We overwrite the whole line, so there is no need to read
+                // the old value in from secondary storage first.
+                slot = allocate(index, delay);
+            }
+            values[*slot] = value;
+            setBit(valid[index % SETS], *slot % Ways);
+            setBit(dirty[index % SETS], *slot % Ways);
+        }
+        CacheStats::bump(hit ? counters.hits : counters.misses);
+        writes.record(latencySince(start, delay));
+        traceAccess(index, TraceRecord::Write, hit);
     }
     else
     {
@@ -106,7 +873,8 @@ void MemMgtUnit::set(std::size_t index, int value)
 // Provide an overload of the array index operator, with 
 // a program termination if an invalid address is provided to use
 //
-int MemMgtUnit::operator[](std::size_t index)
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+int BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::operator[](std::size_t index)
 {
     std::optional<int> value = get(index);
     if (value.has_value())
@@ -119,3 +887,97 @@ int MemMgtUnit::operator[](std::size_t index)
         exit(-1);
     }
 }
+//
+// void MemMgtUnit::flush()
+// Write every dirty line back to memory.  The lines stay valid, so
+// later reads still hit the cache.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::flush()
+{
+    std::chrono::milliseconds delay(0);
+    for (std::size_t set = 0; set < SETS; ++set)
+    {
+        std::lock_guard<std::mutex> lock(setLocks[set].mutex);
+        for (std::size_t way = 0; way < Ways; ++way)
+        {
+            writeBack(set, way, delay);
+        }
+    }
+}
+
+//
+// void MemMgtUnit::setPrefetch(PrefetchConfig)
+// Choose the prefetcher.  The default is not to prefetch.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::setPrefetch(PrefetchConfig config)
+{
+    std::lock_guard<std::mutex> lock(prefetchMutex);
+    prefetch = config;
+}
+
+//
+// void MemMgtUnit::resetStats()
+// Zero the counters and latency histograms, e.g. after a warmup phase.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::resetStats()
+{
+    counters.reset();
+    reads.reset();
+    writes.reset();
+}
+
+//
+// void MemMgtUnit::enableTrace(std::size_t)
+// Start recording accesses in a ring buffer that holds the most recent
+// `records` of them.  Call this before the unit is shared between threads.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::enableTrace(std::size_t records)
+{
+    trace = std::make_unique<AccessTrace>(records);
+}
+
+//
+// bool MemMgtUnit::dumpTrace(const std::string &)
+// Write the recorded accesses to a file.  Returns false if tracing is off
+// or the file could not be written.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+bool BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::dumpTrace(const std::string &path) const
+{
+    return trace && trace->dump(path);
+}
+
+//
+// void traceAccess(std::size_t, TraceRecord::Op, bool)
+// Add an access to the trace, if tracing is on.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::traceAccess(std::size_t index,
+                                                                          TraceRecord::Op op,
+                                                                          bool hit)
+{
+    if (trace)
+    {
+        const auto now = std::chrono::steady_clock::now() - created;
+        trace->record(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+                      index, op, hit);
+    }
+}
+
+//
+// void MemMgtUnit::seed(std::uint32_t)
+// Reseed the storage delay generator so a run can be repeated exactly.
+//
+template <std::size_t Lines, std::size_t Ways, typename Replacement, typename Clock, typename Store>
+void BasicMemMgtUnit<Lines, Ways, Replacement, Clock, Store>::seed(std::uint32_t value)
+{
+    std::lock_guard<std::mutex> lock(delayMutex);
+    delayGen.seed(value);
+    delayDist.reset();
+}
+
+#endif
@@ -0,0 +1,242 @@
+//
+// File:    mmustats.hpp
+// Author:  Your Glorious Instructor
+// Purpose:
+// Instrumentation for the MMU simulator: cache event counters, a latency
+// histogram for get() and set(), and an optional access trace.  All three
+// can be updated from several threads at once.
+//
+#ifndef MMUSTATS_HPP
+#define MMUSTATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//
+// CacheCounters
+// A snapshot of the cache event counters.
+//
+struct CacheCounters
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t writebacks = 0;
+
+    double hitRate() const
+    {
+        const std::uint64_t accesses = hits + misses;
+        return accesses == 0 ? 0.0 : static_cast<double>(hits) / accesses;
+    }
+};
+
+//
+// CacheStats
+// The live counters.  Relaxed atomics are enough: nobody orders other
+// memory operations against a counter.
+//
+struct CacheStats
+{
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+    std::atomic<std::uint64_t> evictions{0};
+    std::atomic<std::uint64_t> writebacks{0};
+
+    static void bump(std::atomic<std::uint64_t> &counter)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    CacheCounters snapshot() const
+    {
+        CacheCounters counters;
+        counters.hits = hits.load(std::memory_order_relaxed);
+        counters.misses = misses.load(std::memory_order_relaxed);
+        counters.evictions = evictions.load(std::memory_order_relaxed);
+        counters.writebacks = writebacks.load(std::memory_order_relaxed);
+        return counters;
+    }
+
+    void reset()
+    {
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+        writebacks = 0;
+    }
+};
+
+//
+// LatencyHistogram
+// Log-bucketed histogram of latencies in nanoseconds.  Each power of two
+// is split into 16 linear sub-buckets, so a reported percentile is within
+// about 6% of the true value no matter whether it is 50ns or 5s.
+//
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr std::size_t SUB_BUCKETS = std::size_t{1} << SUB_BITS;
+    static constexpr std::size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+    static constexpr std::uint64_t MAX_LATENCY = std::uint64_t{1} << 62;
+
+    void record(std::chrono::nanoseconds latency)
+    {
+        // Clamp to keep the top bucket's upper bound representable.
+        const std::uint64_t ns = latency.count() < 0 ? 0
+            : std::min<std::uint64_t>(latency.count(), MAX_LATENCY);
+        buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    std::chrono::nanoseconds mean() const
+    {
+        const std::uint64_t n = count();
+        return std::chrono::nanoseconds(n == 0 ? 0 : sum.load(std::memory_order_relaxed) / n);
+    }
+
+    //
+    // std::chrono::nanoseconds percentile(double)
+    // The latency that q (0..1) of the recorded samples are at or below,
+    // reported as the midpoint of the bucket it falls in.
+    //
+    std::chrono::nanoseconds percentile(double q) const
+    {
+        const std::uint64_t n = count();
+        if (n == 0)
+        {
+            return std::chrono::nanoseconds(0);
+        }
+        const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(q * n + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket)
+        {
+            seen += buckets[bucket].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return std::chrono::nanoseconds((lowerBound(bucket) + lowerBound(bucket + 1)) / 2);
+            }
+        }
+        return std::chrono::nanoseconds(MAX_LATENCY);
+    }
+
+    void reset()
+    {
+        for (auto &bucket : buckets)
+        {
+            bucket = 0;
+        }
+        total = 0;
+        sum = 0;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, BUCKETS> buckets{};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> sum{0};
+
+    // Values below SUB_BUCKETS get a bucket each; above that, the bucket
+    // is picked by the position of the top bit and the SUB_BITS below it.
+    static std::size_t bucketFor(std::uint64_t ns)
+    {
+        if (ns < SUB_BUCKETS)
+        {
+            return ns;
+        }
+        const unsigned top = 63 - __builtin_clzll(ns);
+        const unsigned shift = top - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((ns >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static std::uint64_t lowerBound(std::size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        const unsigned shift = bucket / SUB_BUCKETS - 1;
+        const std::uint64_t sub = bucket % SUB_BUCKETS;
+        return (SUB_BUCKETS + sub) << shift;
+    }
+};
+
+//
+// AccessTrace
+// Fixed size ring buffer of accesses.  When it fills up the oldest records
+// are overwritten.  dump() writes the records oldest first to a binary
+// file: the 8 byte magic "MMUTRACE", a 64-bit record count, and then the
+// records themselves as laid out in TraceRecord (native byte order).
+//
+struct TraceRecord
+{
+    enum Op : std::uint8_t { Read = 0, Write = 1 };
+
+    std::uint64_t timestamp;    // ns since the unit was created
+    std::uint64_t address;
+    std::uint8_t op;
+    std::uint8_t hit;
+    std::uint8_t padding[6];
+};
+static_assert(sizeof(TraceRecord) == 24, "trace records are written to disk as-is");
+
+class AccessTrace
+{
+public:
+    static constexpr char MAGIC[8] = {'M', 'M', 'U', 'T', 'R', 'A', 'C', 'E'};
+
+    explicit AccessTrace(std::size_t capacity) : records(capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::invalid_argument("AccessTrace: capacity must be at least one record");
+        }
+    }
+
+    void record(std::uint64_t timestamp, std::uint64_t address, TraceRecord::Op op, bool hit)
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        records[next % records.size()] = TraceRecord{timestamp, address, op, hit, {}};
+        ++next;
+    }
+
+    //
+    // bool dump(const std::string &)
+    // Write the trace to a file.  Returns false if the file could not be
+    // written.
+    //
+    bool dump(const std::string &path) const
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(traceMutex);
+        const std::uint64_t count = std::min<std::uint64_t>(next, records.size());
+        out.write(MAGIC, sizeof(MAGIC));
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        for (std::uint64_t i = next - count; i < next; ++i)
+        {
+            out.write(reinterpret_cast<const char *>(&records[i % records.size()]), sizeof(TraceRecord));
+        }
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::vector<TraceRecord> records;
+    std::uint64_t next = 0;
+    mutable std::mutex traceMutex;
+};
+
+#endif
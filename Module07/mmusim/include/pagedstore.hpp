@@ -0,0 +1,418 @@
+//
+// File:    pagedstore.hpp
+// Author:  Your Glorious Instructor
+// Purpose:
+// Paged virtual memory to sit behind the MMU cache.  Addresses are
+// translated by a TLB, backed by a multi-level page table, and pages are
+// brought in on demand from a backing file into a fixed pool of physical
+// frames.  When the pool is full a CLOCK sweep picks the frame to give up,
+// writing it back to the file first if it was modified.
+//
+// Template parameters:
+//   PageBits   - a page holds 2^PageBits ints
+//   Levels     - depth of the page table; each level resolves LEVEL_BITS
+//                bits of the virtual page number
+//   TlbEntries - size of the fully associative, LRU managed TLB
+//
+// The virtual address space can therefore be much larger than the frame
+// pool, up to 2^(PageBits + LEVEL_BITS * Levels) ints.  Only page faults
+// go to secondary storage and pay the storage delay, wherever they happen:
+// in fetch(), or in a read() or write() of a page that is not resident
+// (a write-back to a page that was evicted, say); TLB misses are
+// counted, along with the number of page table levels walked, so the cost
+// of translation can be read off the counters.
+//
+// All operations take the store's mutex, so one store can serve every
+// set of the cache.
+//
+#ifndef PAGEDSTORE_HPP
+#define PAGEDSTORE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//
+// PagingCounters
+// A snapshot of the paging event counters.
+//
+struct PagingCounters
+{
+    std::uint64_t tlbHits = 0;
+    std::uint64_t tlbMisses = 0;
+    std::uint64_t walkSteps = 0;        // page table levels visited
+    std::uint64_t pageFaults = 0;
+    std::uint64_t pageEvictions = 0;
+    std::uint64_t pageWritebacks = 0;
+};
+
+template <unsigned PageBits = 10, unsigned Levels = 2, std::size_t TlbEntries = 64>
+class PagedStore
+{
+    static_assert(Levels > 0, "the page table needs at least one level");
+    static_assert(TlbEntries > 0, "the TLB needs at least one entry");
+public:
+    static constexpr unsigned LEVEL_BITS = 10;
+    static constexpr std::size_t PAGE_INTS = std::size_t{1} << PageBits;
+    static constexpr std::uint64_t MAX_SIZE = std::uint64_t{1} << (PageBits + LEVEL_BITS * Levels);
+
+    struct Config
+    {
+        std::uint64_t size = std::min<std::uint64_t>(MAX_SIZE, std::uint64_t{1} << 24);
+        std::size_t frames = 64;
+        // Empty means an anonymous temporary file that goes away with us.
+        std::string backingFile;
+    };
+
+    PagedStore(const PagedStore&) = delete;
+    PagedStore& operator=(const PagedStore&) = delete;
+
+    PagedStore() : PagedStore(Config{}) {}
+
+    explicit PagedStore(const Config &config)
+        : virtualSize(config.size),
+          frameData(std::max<std::size_t>(config.frames, 1) * PAGE_INTS),
+          frames(std::max<std::size_t>(config.frames, 1))
+    {
+        if (virtualSize > MAX_SIZE)
+        {
+            throw std::invalid_argument("PagedStore: address space larger than the page table can map");
+        }
+        if (config.backingFile.empty())
+        {
+            scratch = std::tmpfile();
+            fd = scratch ? fileno(scratch) : -1;
+        }
+        else
+        {
+            fd = ::open(config.backingFile.c_str(), O_RDWR | O_CREAT, 0644);
+            persistent = true;
+        }
+        if (fd < 0)
+        {
+            throw std::runtime_error("PagedStore: unable to open backing file");
+        }
+    }
+
+    ~PagedStore()
+    {
+        if (persistent)
+        {
+            sync();
+            ::close(fd);
+        }
+        else if (scratch)
+        {
+            std::fclose(scratch);
+        }
+    }
+
+    std::uint64_t size() const { return virtualSize; }
+
+    //
+    // void fetch(std::size_t, Delay)
+    // Make sure the page holding address is resident, calling delay() to
+    // pay for the trip to secondary storage if it is not.
+    //
+    template <typename Delay>
+    void fetch(std::size_t address, Delay delay)
+    {
+        lockResident(address >> PageBits, delay);
+    }
+
+    template <typename Delay>
+    int read(std::size_t address, Delay delay)
+    {
+        std::unique_lock<std::mutex> lock = lockResident(address >> PageBits, delay);
+        const std::size_t frame = translate(address >> PageBits);
+        return frameData[frame * PAGE_INTS + (address & (PAGE_INTS - 1))];
+    }
+
+    template <typename Delay>
+    void write(std::size_t address, int value, Delay delay)
+    {
+        std::unique_lock<std::mutex> lock = lockResident(address >> PageBits, delay);
+        const std::size_t frame = translate(address >> PageBits);
+        frameData[frame * PAGE_INTS + (address & (PAGE_INTS - 1))] = value;
+        frames[frame].dirty = true;
+    }
+
+    //
+    // void sync()
+    // Write every modified resident page back to the backing file.
+    //
+    void sync()
+    {
+        std::lock_guard<std::mutex> lock(storeMutex);
+        for (std::size_t frame = 0; frame < frames.size(); ++frame)
+        {
+            if (frames[frame].used && frames[frame].dirty)
+            {
+                writePage(frame);
+            }
+        }
+    }
+
+    PagingCounters stats() const
+    {
+        std::lock_guard<std::mutex> lock(storeMutex);
+        return counters;
+    }
+
+private:
+    static constexpr std::size_t TABLE_ENTRIES = std::size_t{1} << LEVEL_BITS;
+
+    struct PageTableEntry
+    {
+        std::uint32_t frame = 0;
+        bool present = false;
+    };
+
+    // Interior tables only use children, last level tables only use
+    // entries.  Both are allocated the first time they are walked through.
+    struct PageTable
+    {
+        std::vector<std::unique_ptr<PageTable>> children;
+        std::vector<PageTableEntry> entries;
+    };
+
+    struct Frame
+    {
+        std::uint64_t vpn = 0;
+        bool used = false;
+        bool dirty = false;
+        bool referenced = false;
+    };
+
+    std::uint64_t virtualSize;
+    PageTable root;
+    std::vector<int> frameData;
+    std::vector<Frame> frames;
+    std::size_t clockHand = 0;
+
+    std::array<std::uint64_t, TlbEntries> tlbVpn{};
+    std::array<std::uint32_t, TlbEntries> tlbFrame{};
+    std::array<bool, TlbEntries> tlbValid{};
+    std::array<std::uint64_t, TlbEntries> tlbLastUse{};
+    std::uint64_t tlbTick = 0;
+
+    int fd = -1;
+    std::FILE *scratch = nullptr;
+    bool persistent = false;
+
+    PagingCounters counters;
+    mutable std::mutex storeMutex;
+
+    //
+    // std::unique_lock<std::mutex> lockResident(std::uint64_t, Delay)
+    // Take the store's mutex with page vpn resident.  If it is not, call
+    // delay() to pay for the trip to secondary storage (with the mutex let
+    // go, so other pages can be used meanwhile) and then fault the page in.
+    //
+    template <typename Delay>
+    std::unique_lock<std::mutex> lockResident(std::uint64_t vpn, Delay &delay)
+    {
+        std::unique_lock<std::mutex> lock(storeMutex);
+        if (!walk(vpn, false).present)
+        {
+            lock.unlock();
+            delay();
+            lock.lock();
+            PageTableEntry &entry = walk(vpn, false);
+            if (!entry.present)
+            {
+                faultIn(vpn, entry);
+            }
+        }
+        return lock;
+    }
+
+    //
+    // PageTableEntry &walk(std::uint64_t, bool)
+    // Walk the page table from the root down to vpn's entry, building any
+    // missing tables on the way.  count says whether this is a real
+    // translation whose steps go in the counters.
+    //
+    PageTableEntry &walk(std::uint64_t vpn, bool count)
+    {
+        PageTable *table = &root;
+        for (unsigned level = Levels - 1; level > 0; --level)
+        {
+            const std::size_t slot = (vpn >> (LEVEL_BITS * level)) & (TABLE_ENTRIES - 1);
+            if (table->children.empty())
+            {
+                table->children.resize(TABLE_ENTRIES);
+            }
+            if (!table->children[slot])
+            {
+                table->children[slot] = std::make_unique<PageTable>();
+            }
+            table = table->children[slot].get();
+        }
+        if (table->entries.empty())
+        {
+            table->entries.resize(TABLE_ENTRIES);
+        }
+        if (count)
+        {
+            counters.walkSteps += Levels;
+        }
+        return table->entries[vpn & (TABLE_ENTRIES - 1)];
+    }
+
+    //
+    // std::size_t translate(std::uint64_t)
+    // Map a virtual page to its frame, through the TLB if we can and by
+    // walking the page table if we cannot.  The page must be resident;
+    // lockResident() sees to that, and charges for any fault.
+    //
+    std::size_t translate(std::uint64_t vpn)
+    {
+        for (std::size_t i = 0; i < TlbEntries; ++i)
+        {
+            if (tlbValid[i] && tlbVpn[i] == vpn)
+            {
+                ++counters.tlbHits;
+                tlbLastUse[i] = ++tlbTick;
+                frames[tlbFrame[i]].referenced = true;
+                return tlbFrame[i];
+            }
+        }
+        ++counters.tlbMisses;
+        PageTableEntry &entry = walk(vpn, true);
+        if (!entry.present)
+        {
+            faultIn(vpn, entry);
+        }
+        frames[entry.frame].referenced = true;
+
+        std::size_t slot = 0;
+        for (std::size_t i = 0; i < TlbEntries; ++i)
+        {
+            if (!tlbValid[i])
+            {
+                slot = i;
+                break;
+            }
+            if (tlbLastUse[i] < tlbLastUse[slot])
+            {
+                slot = i;
+            }
+        }
+        tlbVpn[slot] = vpn;
+        tlbFrame[slot] = entry.frame;
+        tlbValid[slot] = true;
+        tlbLastUse[slot] = ++tlbTick;
+        return entry.frame;
+    }
+
+    //
+    // void faultIn(std::uint64_t, PageTableEntry &)
+    // Load a page from the backing file into a frame, evicting whatever
+    // the CLOCK hand lands on if no frame is free.
+    //
+    void faultIn(std::uint64_t vpn, PageTableEntry &entry)
+    {
+        ++counters.pageFaults;
+        std::size_t frame = frames.size();
+        for (std::size_t i = 0; i < frames.size(); ++i)
+        {
+            if (!frames[i].used)
+            {
+                frame = i;
+                break;
+            }
+        }
+        if (frame == frames.size())
+        {
+            while (frames[clockHand].referenced)
+            {
+                frames[clockHand].referenced = false;
+                clockHand = (clockHand + 1) % frames.size();
+            }
+            frame = clockHand;
+            clockHand = (clockHand + 1) % frames.size();
+            evict(frame);
+        }
+
+        readPage(vpn, frame);
+        frames[frame] = Frame{vpn, true, false, true};
+        entry.frame = static_cast<std::uint32_t>(frame);
+        entry.present = true;
+    }
+
+    void evict(std::size_t frame)
+    {
+        ++counters.pageEvictions;
+        if (frames[frame].dirty)
+        {
+            writePage(frame);
+        }
+        walk(frames[frame].vpn, false).present = false;
+        for (std::size_t i = 0; i < TlbEntries; ++i)
+        {
+            if (tlbValid[i] && tlbVpn[i] == frames[frame].vpn)
+            {
+                tlbValid[i] = false;
+            }
+        }
+        frames[frame].used = false;
+    }
+
+    // Parts of the file that were never written, past its end, read back
+    // as zeros.  A read that fails is an error, not an empty page.
+    void readPage(std::uint64_t vpn, std::size_t frame)
+    {
+        char *page = reinterpret_cast<char *>(&frameData[frame * PAGE_INTS]);
+        const std::size_t bytes = PAGE_INTS * sizeof(int);
+        std::size_t done = 0;
+        while (done < bytes)
+        {
+            ssize_t got = ::pread(fd, page + done, bytes - done, vpn * bytes + done);
+            if (got == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got == -1)
+            {
+                throw std::runtime_error("PagedStore: unable to read page from backing file");
+            }
+            if (got == 0)
+            {
+                break;
+            }
+            done += got;
+        }
+        std::fill(page + done, page + bytes, 0);
+    }
+
+    void writePage(std::size_t frame)
+    {
+        ++counters.pageWritebacks;
+        const char *page = reinterpret_cast<const char *>(&frameData[frame * PAGE_INTS]);
+        const std::size_t bytes = PAGE_INTS * sizeof(int);
+        std::size_t done = 0;
+        while (done < bytes)
+        {
+            ssize_t put = ::pwrite(fd, page + done, bytes - done, frames[frame].vpn * bytes + done);
+            if (put <= 0)
+            {
+                throw std::runtime_error("PagedStore: unable to write page to backing file");
+            }
+            done += put;
+        }
+        frames[frame].dirty = false;
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+//
+// File:    simclock.hpp
+// Author:  Your Glorious Instructor
+// Purpose:
+// Clock policies for the MMU simulator.  The MMU asks its clock to wait
+// out every trip to secondary storage.
+//   RealTimeClock - actually sleeps, so the simulation runs in real time
+//   VirtualClock  - only adds the delay to a running total, so a million
+//                   simulated accesses finish in seconds
+// Both keep the total time spent waiting in elapsed().  SLEEPS tells the
+// MMU whether a wall clock measurement already includes the wait, so its
+// latency statistics come out the same in either mode.
+//
+#ifndef SIMCLOCK_HPP
+#define SIMCLOCK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+class RealTimeClock
+{
+public:
+    static constexpr bool SLEEPS = true;
+
+    void wait(std::chrono::milliseconds delay)
+    {
+        std::this_thread::sleep_for(delay);
+        if (delay.count() > 0)
+        {
+            waited.fetch_add(delay.count(), std::memory_order_relaxed);
+        }
+    }
+
+    // Total time spent sleeping on secondary storage
+    std::chrono::milliseconds elapsed() const
+    {
+        return std::chrono::milliseconds(waited.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<std::int64_t> waited{0};
+};
+
+class VirtualClock
+{
+public:
+    static constexpr bool SLEEPS = false;
+
+    void wait(std::chrono::milliseconds delay)
+    {
+        if (delay.count() > 0)
+        {
+            waited.fetch_add(delay.count(), std::memory_order_relaxed);
+        }
+    }
+
+    // Total simulated time spent waiting on secondary storage
+    std::chrono::milliseconds elapsed() const
+    {
+        return std::chrono::milliseconds(waited.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<std::int64_t> waited{0};
+};
+
+#endif
@@ -0,0 +1,153 @@
+//
+// File:    tagmatch.hpp
+// Author:  Your Glorious Instructor
+// Purpose:
+// Tag comparison kernels for the MMU cache.  A lookup has to compare the
+// requested tag against every line in a set, which for a large fully
+// associative cache is most of the work on the hit path.  These kernels
+// compare up to 64 tags and return a hit mask with bit i set when
+// tags[i] matches.
+//
+// There is a scalar version plus SSE2 (4 tags per compare), AVX2 (8 tags
+// per compare), and AVX-512 (16 tags per compare) versions.  The widest
+// one the CPU supports is picked the first time tagMatcher() is called,
+// using the CPUID checks built into GCC and Clang.
+//
+#ifndef TAGMATCH_HPP
+#define TAGMATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAGMATCH_X86 1
+#endif
+
+using TagMatchFn = std::uint64_t (*)(const std::uint32_t *, std::size_t, std::uint32_t);
+
+//
+// std::uint64_t matchTagsScalar(const std::uint32_t *, std::size_t, std::uint32_t)
+// Reference version.  count must be no more than 64.
+//
+inline std::uint64_t matchTagsScalar(const std::uint32_t *tags,
+                                     std::size_t count,
+                                     std::uint32_t key)
+{
+    std::uint64_t match = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        match |= std::uint64_t{tags[i] == key} << i;
+    }
+    return match;
+}
+
+#ifdef TAGMATCH_X86
+//
+// std::uint64_t matchTagsSSE2(const std::uint32_t *, std::size_t, std::uint32_t)
+// Compare four tags at a time.  SSE2 is part of the x86-64 baseline, so
+// this version is always available there.
+//
+__attribute__((target("sse2")))
+inline std::uint64_t matchTagsSSE2(const std::uint32_t *tags,
+                                   std::size_t count,
+                                   std::uint32_t key)
+{
+    const __m128i needle = _mm_set1_epi32(static_cast<int>(key));
+    std::uint64_t match = 0;
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags + i));
+        __m128i eq = _mm_cmpeq_epi32(block, needle);
+        std::uint64_t bits = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+        match |= bits << i;
+    }
+    // A shift by 64 is undefined, so only add a tail if there is one
+    if (i < count)
+    {
+        match |= matchTagsScalar(tags + i, count - i, key) << i;
+    }
+    return match;
+}
+
+//
+// std::uint64_t matchTagsAVX2(const std::uint32_t *, std::size_t, std::uint32_t)
+// Compare eight tags at a time.
+//
+__attribute__((target("avx2")))
+inline std::uint64_t matchTagsAVX2(const std::uint32_t *tags,
+                                   std::size_t count,
+                                   std::uint32_t key)
+{
+    const __m256i needle = _mm256_set1_epi32(static_cast<int>(key));
+    std::uint64_t match = 0;
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tags + i));
+        __m256i eq = _mm256_cmpeq_epi32(block, needle);
+        std::uint64_t bits = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+        match |= bits << i;
+    }
+    // A shift by 64 is undefined, so only add a tail if there is one
+    if (i < count)
+    {
+        match |= matchTagsScalar(tags + i, count - i, key) << i;
+    }
+    return match;
+}
+
+//
+// std::uint64_t matchTagsAVX512(const std::uint32_t *, std::size_t, std::uint32_t)
+// Compare sixteen tags at a time.  The tail is handled with a masked load
+// rather than falling back to the scalar loop.
+//
+__attribute__((target("avx512f")))
+inline std::uint64_t matchTagsAVX512(const std::uint32_t *tags,
+                                     std::size_t count,
+                                     std::uint32_t key)
+{
+    const __m512i needle = _mm512_set1_epi32(static_cast<int>(key));
+    std::uint64_t match = 0;
+    for (std::size_t i = 0; i < count; i += 16)
+    {
+        const std::size_t left = count - i;
+        const __mmask16 lanes = left >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << left) - 1);
+        __m512i block = _mm512_maskz_loadu_epi32(lanes, tags + i);
+        std::uint64_t bits = _mm512_mask_cmpeq_epi32_mask(lanes, block, needle);
+        match |= bits << i;
+    }
+    return match;
+}
+#endif
+
+//
+// TagMatchFn tagMatcher()
+// Return the widest tag compare kernel this CPU supports.  The choice is
+// made once and cached.
+//
+inline TagMatchFn tagMatcher()
+{
+    static const TagMatchFn matcher = []() -> TagMatchFn {
+#ifdef TAGMATCH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return matchTagsAVX512;
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return matchTagsAVX2;
+        }
+        if (__builtin_cpu_supports("sse2"))
+        {
+            return matchTagsSSE2;
+        }
+#endif
+        return matchTagsScalar;
+    }();
+    return matcher;
+}
+
+#endif
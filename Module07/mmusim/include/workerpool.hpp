@@ -0,0 +1,111 @@
+//
+// File:    workerpool.hpp
+// Author:  Your Glorious Instructor
+// Purpose:
+// A small fixed-size pool of worker threads that pull jobs off a shared
+// queue.  The MMU uses it to overlap the delays of several trips to
+// secondary storage: each job spends most of its time asleep, so the pool
+// is sized by how many requests we want in flight rather than by the
+// number of cores.
+//
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class WorkerPool
+{
+public:
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    explicit WorkerPool(std::size_t threads)
+    {
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~WorkerPool()
+    {
+        shutdown();
+    }
+
+    //
+    // void shutdown()
+    // Finish every queued job, including any that running jobs queue up
+    // on their way out, then shut the workers down.  The pool stays usable
+    // as an object until it returns, so jobs can keep calling submit().
+    // Must not be called from a worker.
+    //
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+        }
+        jobsReady.notify_all();
+        for (std::thread &worker : workers)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+    }
+
+    //
+    // std::future<R> submit(Job)
+    // Queue a job and return a future for its result.
+    //
+    template <typename Job>
+    auto submit(Job job) -> std::future<std::invoke_result_t<Job>>
+    {
+        using Result = std::invoke_result_t<Job>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.emplace_back([task] { (*task)(); });
+        }
+        jobsReady.notify_one();
+        return result;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex jobsMutex;
+    std::condition_variable jobsReady;
+    bool stopping = false;
+
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(jobsMutex);
+                jobsReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+#endif